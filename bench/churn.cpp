@@ -0,0 +1,43 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+// Measures interest churn on io::trigger: with a resident interest set of
+// the given size, handles are repeatedly set, modified and cleared, as
+// happens with short-lived connections. The poll backend does not touch
+// the kernel on interest changes, so plain integers stand in for handles.
+//
+//	make build/bench/churn
+#include "io.hpp"
+#include <chrono>
+#include <cstdio>
+#include <initializer_list>
+int main(){
+	using clock = std::chrono::steady_clock;
+	constexpr int CHURN = 50000;
+	for(int resident: {1000, 10000, 50000, 100000}){
+		io::trigger trigger;
+		for(int fd = 0; fd < resident; ++fd) trigger.set(fd, POLLIN);
+		auto start = clock::now();
+		for(int i = 0; i < CHURN; ++i){
+			int fd = resident + (i % 1024);
+			trigger.set(fd, POLLIN);
+			trigger.set(fd, POLLOUT);
+			trigger.clear(fd);
+		}
+		std::chrono::duration<double> elapsed = clock::now() - start;
+		std::printf("resident=%d churn/s=%.0f\n", resident, CHURN/elapsed.count());
+	}
+	return 0;
+}
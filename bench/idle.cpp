@@ -0,0 +1,69 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+// Measures the memory held by idle connections: sockbufs are opened over
+// socket pairs, exchange one message and then sit idle, first with eagerly
+// allocated buffers and then in lazy mode, each in a fresh process so
+// that neither run is served from memory the other freed. Raise the open file limit to
+// measure more connections than the default allows.
+//
+//	make build/bench/idle
+#include "buffers.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+static long rss_kb(){
+	long pages = 0, resident = 0;
+	if(FILE *f = std::fopen("/proc/self/statm", "r")){
+		if(std::fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+		std::fclose(f);
+	}
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+int main(int argc, char **argv){
+	using io::buffers::sockbuf;
+	int connections = argc > 1 ? std::atoi(argv[1]) : 500;
+	std::printf("sizeof(sockbuf)=%zu\n", sizeof(sockbuf));
+	std::fflush(stdout);
+	for(bool lazy: {false, true}){
+		pid_t pid = fork();
+		if(pid < 0) return 1;
+		if(pid > 0){
+			waitpid(pid, nullptr, 0);
+			continue;
+		}
+		std::vector<sockbuf> bufs;
+		bufs.reserve(2*connections);
+		long before = rss_kb();
+		for(int i = 0; i < connections; ++i){
+			int sv[2];
+			if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) break;
+			auto& a = bufs.emplace_back(sv[0], std::ios_base::in | std::ios_base::out, lazy);
+			auto& b = bufs.emplace_back(sv[1], std::ios_base::in | std::ios_base::out, lazy);
+			a.sputn("ping", 4);
+			a.pubsync();
+			char msg[4];
+			b.sgetn(msg, sizeof(msg));
+			b.in_avail();
+		}
+		long after = rss_kb();
+		std::printf("lazy=%d connections=%zu rss/connection=%.0fB\n", lazy, bufs.size(), (after - before)*1024.0/bufs.size());
+		return 0;
+	}
+	return 0;
+}
@@ -0,0 +1,430 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+// Microbenchmarks for the poller, trigger and stream buffers. Every result
+// is printed as one JSON object in a JSON array on stdout, so runs can be
+// saved and compared against a baseline:
+//
+//	make build/bench/micro
+//	./build/bench/micro > baseline.json
+//
+// The poller benchmarks register pipes, so the open file limit is raised to
+// its hard limit and the largest sizes are skipped if it is still too low.
+#include "io.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+using clock_type = std::chrono::steady_clock;
+
+static bool first = true;
+static void report(const char *bench, const std::string& params, double value, const char *unit){
+	std::printf("%s\n  {\"bench\": \"%s\", \"params\": {%s}, \"value\": %.3f, \"unit\": \"%s\"}", first ? "[" : ",", bench, params.c_str(), value, unit);
+	first = false;
+}
+
+// flush() returns once the socket would block, so wait for the rest.
+static void flush(io::streams::sockstream& stream){
+	stream.flush();
+	while(stream.pending()){
+		struct pollfd pfd = {stream.native_handle(), POLLOUT, 0};
+		poll(&pfd, 1, -1);
+		stream.flush();
+	}
+}
+
+template<class F>
+static double seconds(F&& f){
+	auto start = clock_type::now();
+	f();
+	return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+template<class TriggerT>
+static void poller_wait(const char *backend, const char *dispatch, int fds){
+	constexpr int ITERATIONS = 20000;
+	std::vector<int> pipes;
+	for(int i = 0; i < fds; ++i){
+		int p[2];
+		if(pipe(p)) break;
+		pipes.push_back(p[0]);
+		pipes.push_back(p[1]);
+	}
+	if(static_cast<int>(pipes.size()) == 2*fds){
+		TriggerT trigger;
+		for(std::size_t i = 0; i < pipes.size(); i += 2) trigger.set(pipes[i], POLLIN);
+		if(write(pipes[1], "x", 1) == 1){
+			double elapsed = seconds([&](){
+				for(int i = 0; i < ITERATIONS; ++i) trigger.wait(std::chrono::milliseconds(0));
+			});
+			report("poller_wait", "\"backend\": \"" + std::string(backend) + "\", \"dispatch\": \"" + dispatch + "\", \"fds\": " + std::to_string(fds), elapsed/ITERATIONS*1e9, "ns/wait");
+		}
+	}
+	for(int fd: pipes) close(fd);
+}
+
+template<class TriggerT>
+static void trigger_churn(const char *dispatch, int resident){
+	constexpr int CHURN = 200000;
+	TriggerT trigger;
+	for(int fd = 0; fd < resident; ++fd) trigger.set(fd, POLLIN);
+	double elapsed = seconds([&](){
+		for(int i = 0; i < CHURN; ++i){
+			int fd = resident + (i % 1024);
+			trigger.set(fd, POLLIN);
+			trigger.set(fd, POLLOUT);
+			trigger.clear(fd);
+		}
+	});
+	report("trigger_churn", "\"dispatch\": \"" + std::string(dispatch) + "\", \"resident\": " + std::to_string(resident), elapsed/CHURN*1e9, "ns/cycle");
+}
+
+struct virtual_handler: public io::basic_handler<io::etrigger> {
+	using Base = io::basic_handler<io::etrigger>;
+	std::size_t count{0};
+	int _handle(events_view events) override {
+		for(auto& event: events) count += io::revents(event) & POLLIN;
+		return 0;
+	}
+};
+
+struct static_handler: public io::basic_static_handler<static_handler, io::static_etrigger> {
+	using Base = io::basic_static_handler<static_handler, io::static_etrigger>;
+	std::size_t count{0};
+	int _handle(events_view events){
+		for(auto& event: events) count += io::revents(event) & POLLIN;
+		return 0;
+	}
+};
+
+// A wait and a dispatch of 64 ready pipes per iteration, the part of an
+// event loop that runs once per wakeup.
+template<class TriggerT, class HandlerT>
+static void loop_dispatch(const char *dispatch){
+	constexpr int ITERATIONS = 100000;
+	constexpr int FDS = 64;
+	std::vector<int> pipes;
+	TriggerT trigger;
+	HandlerT handler;
+	for(int i = 0; i < FDS; ++i){
+		int p[2];
+		if(pipe(p)) break;
+		pipes.push_back(p[0]);
+		pipes.push_back(p[1]);
+		trigger.set(p[0], POLLIN);
+		if(write(p[1], "x", 1) != 1) break;
+	}
+	if(static_cast<int>(pipes.size()) == 2*FDS){
+		// Handlers are normally reached through their base.
+		typename HandlerT::Base& base = handler;
+		double elapsed = seconds([&](){
+			for(int i = 0; i < ITERATIONS; ++i){
+				trigger.wait(std::chrono::milliseconds(0));
+				base.handle(trigger.ready());
+			}
+		});
+		report("loop_dispatch", "\"dispatch\": \"" + std::string(dispatch) + "\", \"fds\": " + std::to_string(FDS), elapsed/ITERATIONS*1e9, "ns/iteration");
+	}
+	for(int fd: pipes) close(fd);
+}
+
+static void sockstream_throughput(std::size_t msgsize){
+	constexpr std::size_t TOTAL = 64 << 20;
+	int sv[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) return;
+	io::streams::sockstream writer(sv[0]), reader(sv[1]);
+	std::vector<char> msg(msgsize, 'x');
+	double elapsed = seconds([&](){
+		std::thread consumer([&](){
+			std::vector<char> buf(msgsize);
+			for(std::size_t got = 0; got < TOTAL; got += msgsize) reader.read(buf.data(), msgsize);
+		});
+		for(std::size_t sent = 0; sent < TOTAL; sent += msgsize) writer.write(msg.data(), msgsize);
+		flush(writer);
+		consumer.join();
+	});
+	report("sockstream_throughput", "\"msgsize\": " + std::to_string(msgsize), TOTAL/elapsed/(1 << 20), "MiB/s");
+}
+
+static void sockstream_latency(std::size_t msgsize){
+	constexpr int ROUNDTRIPS = 20000;
+	int sv[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) return;
+	io::streams::sockstream client(sv[0]), server(sv[1]);
+	std::vector<char> msg(msgsize, 'x');
+	std::thread echo([&](){
+		std::vector<char> buf(msgsize);
+		for(int i = 0; i < ROUNDTRIPS; ++i){
+			server.read(buf.data(), msgsize);
+			server.write(buf.data(), msgsize);
+			flush(server);
+		}
+	});
+	double elapsed = seconds([&](){
+		for(int i = 0; i < ROUNDTRIPS; ++i){
+			client.write(msg.data(), msgsize);
+			flush(client);
+			client.read(msg.data(), msgsize);
+		}
+	});
+	echo.join();
+	report("sockstream_latency", "\"msgsize\": " + std::to_string(msgsize), elapsed/ROUNDTRIPS*1e6, "us/roundtrip");
+}
+
+static void pipestream_throughput(std::size_t msgsize){
+	constexpr std::size_t TOTAL = 64 << 20;
+	std::vector<char> msg(msgsize, 'x');
+	{
+		io::streams::pipestream pipe(std::ios_base::out);
+		int rfd = pipe.native_handle()[0];
+		double elapsed = seconds([&](){
+			std::thread consumer([&](){
+				std::vector<char> buf(65536);
+				std::size_t got = 0;
+				while(got < TOTAL){
+					ssize_t len = read(rfd, buf.data(), buf.size());
+					if(len > 0) got += len;
+					else std::this_thread::yield();
+				}
+			});
+			for(std::size_t sent = 0; sent < TOTAL; sent += msgsize) pipe.write(msg.data(), msgsize);
+			pipe.flush();
+			while(pipe.write_remaining()) pipe.flush();
+			consumer.join();
+		});
+		report("pipestream_write", "\"msgsize\": " + std::to_string(msgsize), TOTAL/elapsed/(1 << 20), "MiB/s");
+	}
+	{
+		io::streams::pipestream pipe(std::ios_base::in);
+		int wfd = pipe.native_handle()[1];
+		double elapsed = seconds([&](){
+			std::thread producer([&](){
+				std::vector<char> buf(65536, 'x');
+				std::size_t sent = 0;
+				while(sent < TOTAL){
+					ssize_t len = write(wfd, buf.data(), std::min(buf.size(), TOTAL - sent));
+					if(len > 0) sent += len;
+					else std::this_thread::yield();
+				}
+			});
+			std::vector<char> buf(msgsize);
+			for(std::size_t got = 0; got < TOTAL; got += msgsize) pipe.read(buf.data(), msgsize);
+			producer.join();
+		});
+		report("pipestream_read", "\"msgsize\": " + std::to_string(msgsize), TOTAL/elapsed/(1 << 20), "MiB/s");
+	}
+}
+
+// Consumes half of what is buffered before every sync(), so each sync()
+// has to move the unread half to the front of the get area first. Ring
+// mode moves nothing, which puts a number on the copying.
+static void recv_compaction(bool ring){
+	constexpr std::size_t TOTAL = 64 << 20;
+	int sv[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) return;
+	io::streams::sockstream writer(sv[0]);
+	io::buffers::sockbuf reader(sv[1], std::ios_base::in);
+	reader.ring_mode(ring);
+	double elapsed = seconds([&](){
+		std::thread producer([&](){
+			std::vector<char> msg(16384, 'x');
+			for(std::size_t sent = 0; sent < TOTAL; sent += msg.size()) writer.write(msg.data(), msg.size());
+			flush(writer);
+		});
+		std::vector<char> buf(65536);
+		std::size_t got = 0;
+		while(got < TOTAL){
+			std::streamsize avail = reader.in_avail();
+			if(avail <= 0){
+				if(reader.sgetc() == std::char_traits<char>::eof()) break;
+				continue;
+			}
+			std::streamsize take = std::max<std::streamsize>(avail/2, 1);
+			got += reader.sgetn(buf.data(), std::min<std::streamsize>(take, buf.size()));
+			reader.pubsync();
+		}
+		producer.join();
+	});
+	report("recv_compaction", std::string("\"ring_mode\": ") + (ring ? "true" : "false"), TOTAL/elapsed/(1 << 20), "MiB/s");
+}
+
+// Flushes of msgsize bytes over TCP, copied or sent with MSG_ZEROCOPY.
+// Every message is at the zerocopy threshold. Loopback copies zerocopy
+// pages anyway, so there this measures the cost of the completions; the
+// copy saved only shows when the peer is behind a real device.
+static void zerocopy_send(std::size_t msgsize, bool zerocopy){
+	constexpr std::size_t TOTAL = 256 << 20;
+	int listener = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addrlen = sizeof(addr);
+	if(listener < 0 || bind(listener, reinterpret_cast<struct sockaddr*>(&addr), addrlen) || listen(listener, 1)
+		|| getsockname(listener, reinterpret_cast<struct sockaddr*>(&addr), &addrlen)){
+		if(listener >= 0) close(listener);
+		return;
+	}
+	int client = socket(AF_INET, SOCK_STREAM, 0);
+	if(client < 0 || connect(client, reinterpret_cast<struct sockaddr*>(&addr), addrlen)){
+		if(client >= 0) close(client);
+		close(listener);
+		return;
+	}
+	int server = accept(listener, nullptr, nullptr);
+	close(listener);
+	{
+		io::streams::sockstream writer(client);
+		if(zerocopy && writer.zerocopy(msgsize)){
+			close(server);
+			return;
+		}
+		std::vector<char> msg(msgsize, 'x');
+		double elapsed = seconds([&](){
+			std::thread consumer([&](){
+				std::vector<char> buf(1 << 20);
+				for(std::size_t got = 0; got < TOTAL;){
+					ssize_t len = read(server, buf.data(), buf.size());
+					if(len <= 0) break;
+					got += len;
+				}
+			});
+			for(std::size_t sent = 0; sent < TOTAL; sent += msgsize){
+				writer.write(msg.data(), msgsize);
+				flush(writer);
+			}
+			consumer.join();
+		});
+		report("zerocopy_send", "\"msgsize\": " + std::to_string(msgsize) + ", \"zerocopy\": " + (zerocopy ? "true" : "false"), TOTAL/elapsed/(1 << 20), "MiB/s");
+	}
+	close(server);
+}
+
+// Writes into a socket nobody is reading, so once the socket buffer is full
+// every put area that fills up is retired to the write queue and replaced,
+// which is the cost of _resizewbuf() and of the buffer allocator. Only the
+// second of two passes is reported: the first mostly measures fresh pages
+// being faulted in, which either allocator pays once, and the second what
+// a long-running process sees, where the heap may have trimmed and has to
+// fault its pages in again, while the pool still holds them.
+static void queue_growth(bool pool){
+	constexpr std::size_t TOTAL = 16 << 20;
+	constexpr std::size_t MSGSIZE = 4096;
+	auto *previous = io::buffers::buffer_resource(pool ? &io::buffers::buffer_pool::local() : nullptr);
+	for(int pass = 0; pass < 2; ++pass){
+		int sv[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) break;
+		io::streams::sockstream writer(sv[0]);
+		std::vector<char> msg(MSGSIZE, 'x');
+		double elapsed = seconds([&](){
+			for(std::size_t sent = 0; sent < TOTAL; sent += MSGSIZE) writer.write(msg.data(), MSGSIZE);
+		});
+		std::thread consumer([&](){
+			std::vector<char> buf(65536);
+			while(read(sv[1], buf.data(), buf.size()) > 0);
+		});
+		flush(writer);
+		shutdown(sv[0], SHUT_WR);
+		consumer.join();
+		close(sv[1]);
+		if(pass) report("queue_growth", std::string("\"allocator\": \"") + (pool ? "buffer_pool" : "default") + "\"", TOTAL/elapsed/(1 << 20), "MiB/s");
+	}
+	io::buffers::buffer_resource(previous);
+}
+
+// Opens a connection, exchanges one message and closes it, over and over,
+// the way a server handling short-lived clients does. Each stream is lazy
+// with bufsize bytes per area, so every connection allocates and frees
+// its buffers once; a buffer_pool hands back pages that are already
+// faulted in, where the heap may have trimmed and remapped them.
+static void connection_churn(std::size_t bufsize, bool pool){
+	constexpr int CONNECTIONS = 20000;
+	auto *previous = io::buffers::buffer_resource(pool ? &io::buffers::buffer_pool::local() : nullptr);
+	double elapsed = seconds([&](){
+		for(int i = 0; i < CONNECTIONS; ++i){
+			int sv[2];
+			if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) return;
+			io::buffers::sockbuf client(sv[0], std::ios_base::in | std::ios_base::out, true);
+			io::buffers::sockbuf server(sv[1], std::ios_base::in | std::ios_base::out, true);
+			client.bufsize() = server.bufsize() = bufsize;
+			char msg[64] = {};
+			client.sputn(msg, sizeof(msg));
+			client.pubsync();
+			server.sgetn(msg, sizeof(msg));
+		}
+	});
+	report("connection_churn", "\"bufsize\": " + std::to_string(bufsize) + ", \"allocator\": \"" + (pool ? "buffer_pool" : "default") + "\"", elapsed/CONNECTIONS*1e6, "us/connection");
+	io::buffers::buffer_resource(previous);
+}
+
+// A worker thread posting to a loop through a task_queue. Reports the cost
+// per task and how many posts each wakeup of the loop absorbed.
+static void task_post(){
+	constexpr long POSTS = 1000000;
+	io::etrigger trigger;
+	io::task_queue tasks;
+	trigger.attach(&tasks);
+	long ran = 0, wakeups = 0;
+	double elapsed = seconds([&](){
+		std::thread worker([&](){
+			for(long i = 0; i < POSTS; ++i) tasks.post([&ran](){ ++ran; });
+		});
+		while(ran < POSTS){
+			if(trigger.wait(std::chrono::milliseconds(100)) > 0) ++wakeups;
+		}
+		worker.join();
+	});
+	report("task_post", "\"threads\": 1", elapsed/POSTS*1e9, "ns/task");
+	report("task_post_coalescing", "\"threads\": 1", static_cast<double>(POSTS)/(wakeups ? wakeups : 1), "tasks/wakeup");
+}
+
+int main(){
+	struct rlimit limit = {};
+	if(getrlimit(RLIMIT_NOFILE, &limit) == 0){
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	for(int fds: {16, 256, 1024, 4096}){
+		poller_wait<io::trigger>("poll", "virtual", fds);
+		poller_wait<io::static_trigger>("poll", "static", fds);
+		poller_wait<io::etrigger>("epoll", "virtual", fds);
+		poller_wait<io::static_etrigger>("epoll", "static", fds);
+	}
+	for(int resident: {1000, 10000, 100000}){
+		trigger_churn<io::trigger>("virtual", resident);
+		trigger_churn<io::static_trigger>("static", resident);
+	}
+	loop_dispatch<io::etrigger, virtual_handler>("virtual");
+	loop_dispatch<io::static_etrigger, static_handler>("static");
+	for(std::size_t msgsize: {64, 1024, 16384, 65536}) sockstream_throughput(msgsize);
+	for(std::size_t msgsize: {64, 1024, 16384}) sockstream_latency(msgsize);
+	for(std::size_t msgsize: {64, 4096, 65536}) pipestream_throughput(msgsize);
+	for(bool ring: {false, true}) recv_compaction(ring);
+	for(std::size_t msgsize: {16384, 65536, 262144})
+		for(bool zerocopy: {false, true}) zerocopy_send(msgsize, zerocopy);
+	for(bool pool: {false, true}) queue_growth(pool);
+	for(std::size_t bufsize: {16384, 262144})
+		for(bool pool: {false, true}) connection_churn(bufsize, pool);
+	task_post();
+	std::printf("%s\n]\n", first ? "[" : "");
+	return 0;
+}
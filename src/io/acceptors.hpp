@@ -0,0 +1,104 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "io.hpp"
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#pragma once
+#ifndef IO_ACCEPTORS
+#define IO_ACCEPTORS
+namespace io {
+	// Drains a listening socket's backlog each time the trigger reports it
+	// ready. accept() calls accept4(2) until it would block, or until limit
+	// connections have been taken when a limit is set, so that a storm of
+	// connections cannot starve the rest of the loop. Each new socket is
+	// non-blocking and close-on-exec, and is wrapped in a lazy sockstream
+	// appended to the caller's vector, which takes its buffers from
+	// buffers::buffer_resource() on first use, so a buffer_pool serves them
+	// from slabs that are already mapped. Once the batch is complete, all of
+	// them are registered with the trigger for events in one batched set().
+	// The caller owns the streams from then on, and must clear them from the
+	// trigger before they are dropped.
+	template<class TriggerT>
+	class basic_acceptor {
+		public:
+			using trigger_type = TriggerT;
+			using mask_type = typename trigger_type::trigger_type;
+			using native_handle_type = typename trigger_type::native_handle_type;
+			using sockstream = streams::sockstream;
+			using streams_type = std::vector<sockstream>;
+			using size_type = std::size_t;
+			
+			basic_acceptor(trigger_type& trigger, sockstream& listener, mask_type events = POLLIN, size_type limit = 0):
+				_trigger{trigger},
+				_listener{listener},
+				_events{events},
+				_limit{limit}
+			{
+				if(_limit) _handles.reserve(_limit);
+				native_handle_type sockfd = _listener.native_handle();
+				int flags = fcntl(sockfd, F_GETFL);
+				if(flags >= 0 && !(flags & O_NONBLOCK)) fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
+				_trigger.set(sockfd, POLLIN);
+			}
+			
+			basic_acceptor(const basic_acceptor& other) = delete;
+			basic_acceptor& operator=(const basic_acceptor& other) = delete;
+			
+			// Appends the connections accepted to accepted and returns how
+			// many there were, so a vector the caller clears and passes
+			// again keeps its capacity. Failures other than the backlog
+			// running dry, or a connection aborted before it was taken, end
+			// the batch early and are kept in err().
+			size_type accept(streams_type& accepted){
+				_handles.clear();
+				native_handle_type sockfd = _listener.native_handle();
+				while(!_limit || _handles.size() < _limit){
+					native_handle_type socket = accept4(sockfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+					if(socket < 0){
+						if(errno == EINTR || errno == ECONNABORTED || errno == EPROTO) continue;
+						if(errno != EAGAIN && errno != EWOULDBLOCK) _errno = errno;
+						break;
+					}
+					accepted.emplace_back(socket, std::ios_base::in | std::ios_base::out, true);
+					_handles.push_back(socket);
+				}
+				_trigger.set(_handles.begin(), _handles.end(), _events);
+				return _handles.size();
+			}
+			
+			native_handle_type native_handle() { return _listener.native_handle(); }
+			size_type limit() { return _limit; }
+			void limit(size_type limit) { _limit = limit; }
+			int err() { return _errno; }
+			
+			~basic_acceptor(){ _trigger.clear(_listener.native_handle(), POLLIN); }
+			
+		private:
+			trigger_type& _trigger;
+			sockstream& _listener;
+			mask_type _events;
+			size_type _limit;
+			std::vector<native_handle_type> _handles{};
+			int _errno{0};
+	};
+	
+	using acceptor = basic_acceptor<trigger>;
+}
+#endif
@@ -17,11 +17,20 @@
 #include <initializer_list>
 #include <streambuf>
 #include <array>
+#include <atomic>
 #include <vector>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <string>
 #include <tuple>
+#include <functional>
+#include <cerrno>
+#include <cstdint>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #pragma once
 #ifndef IO_BUFFERS
@@ -31,6 +40,203 @@ namespace io{
         using optname = std::string;
         using optval = std::vector<char>;
         using sockopt = std::tuple<std::string, std::vector<char> >;
+        
+        // A socket option as a type: the level and name passed to
+        // setsockopt(2) and the type of its value. Setting or reading one
+        // is a single syscall and never allocates.
+        template<int Level, int Name, class T = int>
+        struct socket_option {
+            static constexpr int level = Level;
+            static constexpr int name = Name;
+            using value_type = T;
+            value_type value{};
+        };
+        
+        namespace sockopts {
+            using reuseaddr = socket_option<SOL_SOCKET, SO_REUSEADDR>;
+            using reuseport = socket_option<SOL_SOCKET, SO_REUSEPORT>;
+            using rcvbuf = socket_option<SOL_SOCKET, SO_RCVBUF>;
+            using sndbuf = socket_option<SOL_SOCKET, SO_SNDBUF>;
+            using linger = socket_option<SOL_SOCKET, SO_LINGER, struct ::linger>;
+            // Microseconds to busy poll the device queue on a blocking read.
+            using busy_poll = socket_option<SOL_SOCKET, SO_BUSY_POLL>;
+            using nodelay = socket_option<IPPROTO_TCP, TCP_NODELAY>;
+            using cork = socket_option<IPPROTO_TCP, TCP_CORK>;
+            // Not sticky: the kernel may leave quick ack mode on its own.
+            using quickack = socket_option<IPPROTO_TCP, TCP_QUICKACK>;
+            // Seconds a listener waits for data before accepting.
+            using defer_accept = socket_option<IPPROTO_TCP, TCP_DEFER_ACCEPT>;
+            // The listener's queue of pending fast open requests.
+            using fastopen = socket_option<IPPROTO_TCP, TCP_FASTOPEN>;
+        }
+        
+        // A memfd region mapped twice, back to back, so that any span of up
+        // to size() bytes starting inside the first mapping is contiguous.
+        // Used as a get area that never needs compacting: once gptr() has
+        // moved past the first mapping, the get area is moved back by
+        // size() bytes without copying anything.
+        class ring_buffer {
+            public:
+                ring_buffer() = default;
+                explicit ring_buffer(std::size_t size);
+                ring_buffer(ring_buffer&& other);
+                ring_buffer& operator=(ring_buffer&& other);
+                
+                char *data() { return _data; }
+                std::size_t size() { return _size; }
+                
+                ~ring_buffer();
+            private:
+                char *_data{nullptr};
+                std::size_t _size{0};
+        };
+        
+        // A FIFO over a vector, which unlike std::deque allocates nothing
+        // until the first push. Popped elements are reset to T{} at once,
+        // and their slots, with any storage a reset keeps, reclaimed when
+        // the queue drains or they make up half of it. clear() keeps the
+        // capacity, release() frees it.
+        template<class T>
+        class vector_queue {
+            public:
+                using iterator = typename std::vector<T>::iterator;
+                
+                bool empty() const { return _head == _items.size(); }
+                std::size_t size() const { return _items.size() - _head; }
+                T& front() { return _items[_head]; }
+                T& back() { return _items.back(); }
+                iterator begin() { return _items.begin() + _head; }
+                iterator end() { return _items.end(); }
+                
+                void push_back(T&& item){ _items.push_back(std::move(item)); }
+                void push_back(const T& item){ _items.push_back(item); }
+                void pop_front(){
+                    _items[_head] = T{};
+                    if(++_head == _items.size()) clear();
+                    else if(2*_head >= _items.size()){
+                        _items.erase(_items.begin(), _items.begin() + _head);
+                        _head = 0;
+                    }
+                }
+                void clear(){ _items.clear(); _head = 0; }
+                void release(){ _items = std::vector<T>(); _head = 0; }
+            private:
+                std::vector<T> _items{};
+                std::size_t _head{0};
+        };
+        
+        // A size-classed pool of page-aligned buffers carved out of 2 MiB
+        // slabs. Freed buffers go back onto the free list of their class
+        // instead of to the heap, so connection churn does not fragment it
+        // and a recycled buffer's pages are already faulted in. Requests
+        // larger than a slab are mapped and unmapped on their own. Slabs
+        // are only returned to the system when the pool is destroyed.
+        // A lock serializes the pool, so a stream whose buffers it holds
+        // may move to and be destroyed on another thread. It is only
+        // contended when it does; use one pool per thread, see local().
+        class buffer_pool : public std::pmr::memory_resource {
+            public:
+                static constexpr std::size_t SLABSIZE = 2*1024*1024;
+                static constexpr std::size_t NCLASSES = 21;
+                
+                explicit buffer_pool(bool hugepages = false);
+                buffer_pool(const buffer_pool& other) = delete;
+                buffer_pool& operator=(const buffer_pool& other) = delete;
+                
+                std::size_t slabs();
+                // The calling thread's pool. It is never destroyed, and
+                // is handed to another thread once this one exits.
+                static buffer_pool& local();
+                
+                ~buffer_pool();
+            protected:
+                void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+                void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override;
+                bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+            private:
+                struct block { block *next; };
+                std::mutex _mutex{};
+                std::array<block*, NCLASSES> _free{};
+                std::array<char*, NCLASSES> _next{}, _end{};
+                std::vector<char*> _slabs{};
+                std::size_t _page;
+                bool _hugepages;
+                
+                std::size_t _class(std::size_t bytes);
+                std::size_t _classsize(std::size_t cls);
+                char *_map(std::size_t size);
+                void *_carve(std::size_t cls);
+        };
+        
+        // The memory resource that sockbufs and pipebufs constructed on the
+        // calling thread draw their buffers from, std::pmr::get_default_resource()
+        // unless it has been set. Setting it returns the previous resource.
+        std::pmr::memory_resource *buffer_resource();
+        std::pmr::memory_resource *buffer_resource(std::pmr::memory_resource *resource);
+        
+        // A snapshot of a stream's I/O counters. sendmmsg(2) and recvmmsg(2)
+        // count as SENDMSG and RECVMSG, splice(2) as SENDFILE. BYTES_MOVED
+        // is what the get area compaction copied, WBUF_GROWN and WBUF_SHRUNK
+        // count write buffers added to and released from a stream.
+        struct io_stats {
+            enum counter {
+                SENDMSG, RECVMSG, READ, WRITE, SENDFILE,
+                BYTES_IN, BYTES_OUT, WOULDBLOCK, INTERRUPTED,
+                BYTES_MOVED, WBUF_GROWN, WBUF_SHRUNK, BLOCKED_NS,
+                NCOUNTERS
+            };
+            std::array<std::uint64_t, NCOUNTERS> counters{};
+            
+            std::uint64_t& operator[](counter c) { return counters[c]; }
+            std::uint64_t operator[](counter c) const { return counters[c]; }
+            io_stats& operator+=(const io_stats& other){
+                for(std::size_t i = 0; i < NCOUNTERS; ++i) counters[i] += other.counters[i];
+                return *this;
+            }
+        };
+        
+#if defined(IO_STATS)
+        // The counters of one sockbuf or pipebuf. Only the thread using the
+        // stream updates them, so they are plain relaxed loads and stores,
+        // but every live instance is linked into a list that aggregate_stats()
+        // reads from any thread. A moved stream takes its counters along.
+        class stream_stats {
+            public:
+                stream_stats();
+                stream_stats(stream_stats&& other);
+                stream_stats& operator=(stream_stats&& other);
+                
+                void add(io_stats::counter c, std::uint64_t n = 1){
+                    auto& counter = _counters[c];
+                    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+                }
+                std::uint64_t now();
+                io_stats snapshot() const;
+                
+                ~stream_stats();
+            private:
+                std::array<std::atomic<std::uint64_t>, io_stats::NCOUNTERS> _counters{};
+                stream_stats *_prev{nullptr}, *_next{nullptr};
+                
+                void _take(stream_stats& other);
+                friend io_stats aggregate_stats();
+        };
+#else
+        // Without -DIO_STATS streams keep no counters and every update
+        // compiles to nothing.
+        class stream_stats {
+            public:
+                void add(io_stats::counter, std::uint64_t = 1){}
+                std::uint64_t now() { return 0; }
+                io_stats snapshot() const { return {}; }
+        };
+#endif
+        
+        // The counters summed over every live stream, and over every stream
+        // destroyed so far. All zero unless the library and everything
+        // including buffers.hpp are compiled with -DIO_STATS.
+        io_stats aggregate_stats();
+        io_stats retired_stats();
             
         class pipebuf : public std::streambuf {
             public:
@@ -38,8 +244,9 @@ namespace io{
                 using traits = Base::traits_type;
                 using int_type = Base::int_type;
                 using char_type = Base::char_type;
-                using buffer = std::vector<char>;
+                using buffer = std::pmr::vector<char>;
                 using native_handle_type = int*;
+                using interest_type = std::function<void(int, short)>;
                 static constexpr std::size_t DEFAULT_BUFSIZE = 4096;
                 
                 
@@ -55,6 +262,18 @@ namespace io{
                 void close_write();
                 std::size_t write_remaining();
                 std::ios_base::openmode mode() { return _which; }
+                bool ring_mode() { return _ring.data() != nullptr; }
+                int ring_mode(bool enable);
+                std::pmr::memory_resource *resource() { return _resource; }
+                // See sockbuf::nonblocking(). Interest in POLLIN is reported
+                // for the read end of the pipe and POLLOUT for the write end.
+                void nonblocking(bool enable, interest_type interest = {});
+                bool nonblocking() { return _nonblocking; }
+                short blocked() { return _blocked; }
+                // See sockbuf::fill() and sockbuf::drain().
+                int fill();
+                int drain();
+                io_stats stats() const { return _stats.snapshot(); }
                 
                 ~pipebuf();
             protected:
@@ -66,10 +285,18 @@ namespace io{
                 int_type overflow(int_type ch = traits::eof()) override;
             private:
                 std::ios_base::openmode _which{};
-                buffer _read, _write;
+                std::pmr::memory_resource *_resource{buffer_resource()};
+                buffer _read = buffer(_resource), _write = buffer(_resource);
+                ring_buffer _ring{};
                 std::array<int, 2> _pipe{};
                 std::size_t BUFSIZE;
+                interest_type _interest{};
+                short _blocked{0};
+                bool _nonblocking{false};
+                stream_stats _stats{};
                 
+                int _wait(short events);
+                void _want(short events, bool enable);
                 int _send(char_type *buf, std::size_t size);
                 int _recv();
                 void _mvrbuf();
@@ -78,23 +305,63 @@ namespace io{
         
         
         
+        // Runs the sends and receives of a sockbuf in completion mode, see
+        // upoller. A request is only handed to the kernel with the engine's
+        // next wait, and done is called from a later wait with what the
+        // syscall would have returned, or -errno. It returns the poll events
+        // that wait reports for the handle, 0 for none. The msghdr and the
+        // memory it points to must stay valid until done has been called.
+        class completion_engine {
+            public:
+                using id_type = std::uint64_t;
+                using done_type = std::function<short(int)>;
+                
+                // Both return 0 when the request could not be queued.
+                virtual id_type sendmsg(int handle, const struct msghdr *msg, int flags, done_type done) = 0;
+                virtual id_type recvmsg(int handle, struct msghdr *msg, int flags, done_type done) = 0;
+                // Asks the kernel to finish a request early, done is still called.
+                virtual void cancel(id_type id) = 0;
+                
+            protected:
+                ~completion_engine() = default;
+        };
+        
         class sockbuf : public std::streambuf {
             public:     
                 using Base = std::streambuf;
                 using int_type = Base::int_type;
                 using traits_t = Base::traits_type;
                 using char_type = Base::char_type;
-                using buffer = std::vector<char>;
+                using buffer = std::pmr::vector<char>;
                 using size_type = std::size_t;
                 using native_handle_type = int;
                 using msghdr_t = struct msghdr;
                 using iovec = struct iovec;
                 using msghdr_array_t = std::array<msghdr_t, 2>;
-                using cbuf_array_t = std::array<buffer, 2>;
+                using cbuf_array_t = std::array<std::vector<char>, 2>;
                 using address_type = std::tuple<struct sockaddr_storage, socklen_t>;
                 using storage_array = std::array<address_type, 2>;
+                using file_range = std::tuple<native_handle_type, off_t>;
+                using segment_type = std::tuple<iovec, bool, file_range>;
+                using write_queue = vector_queue<segment_type>;
+                using zerocopy_type = std::tuple<std::uint32_t, buffer>;
+                using mmsghdr_t = struct mmsghdr;
+                using interest_type = std::function<void(native_handle_type, short)>;
                 static constexpr size_type DEFAULT_BUFSIZE = 16535;
                 
+                // Preallocated message headers, payload slots, addresses and
+                // control buffers for moving several datagrams per syscall.
+                // Messages [head, count) are the ones received by the last
+                // recvbatch(), or queued and not yet sent for the out batch.
+                struct batch_type {
+                    std::vector<mmsghdr_t> msgs{};
+                    std::vector<iovec> iovs{};
+                    std::vector<struct sockaddr_storage> addrs{};
+                    std::vector<char> data{}, control{};
+                    size_type msgsize{0}, cmsgsize{0}, head{0}, count{0};
+                };
+                using batch_array_t = std::array<batch_type, 2>;
+                
                 
                 sockbuf();
                 sockbuf(int domain, int type, int protocol)
@@ -107,8 +374,10 @@ namespace io{
                 sockbuf(sockfd, std::ios_base::in | std::ios_base::out){}
                     
                 sockbuf(sockbuf&& other);
-                explicit sockbuf(native_handle_type sockfd, std::ios_base::openmode which);
-                explicit sockbuf(int domain, int type, int protocol, std::initializer_list<sockopt> l, std::ios_base::openmode which);
+                // With lazy set the sockbuf starts in lazy mode, see lazy(),
+                // and allocates no buffers until it is first used.
+                explicit sockbuf(native_handle_type sockfd, std::ios_base::openmode which, bool lazy = false);
+                explicit sockbuf(int domain, int type, int protocol, std::initializer_list<sockopt> l, std::ios_base::openmode which, bool lazy = false);
 
                 sockbuf& operator=(sockbuf&& other);
                 
@@ -118,9 +387,82 @@ namespace io{
                 storage_array& addresses() { return _addresses; }
 
                 int err(){ return _errno; }
+                batch_array_t& batches() { return _batches; }
+                void batchsize(size_type count, size_type msgsize, size_type cmsgsize = 0);
+                int recvbatch();
+                int pushbatch(const char_type *buf, size_type size, const struct sockaddr *addr = nullptr, socklen_t addrlen = 0);
+                int sendbatch();
+                bool ring_mode() { return _ring.data() != nullptr; }
+                int ring_mode(bool enable);
+                std::pmr::memory_resource *resource() { return _resource; }
+                // In lazy mode the get and put areas are only allocated when
+                // they are first used. The put area is released again by
+                // sync() once everything written has been sent, and the get
+                // area once everything received has been read and in_avail()
+                // finds nothing more, so an idle sockbuf holds no buffers.
+                void lazy(bool enable);
+                bool lazy() { return _lazy; }
+                // Never waits for the socket: blocked() holds the events to
+                // wait for, passed to interest whenever they change.
+                void nonblocking(bool enable, interest_type interest = {});
+                bool nonblocking() { return _nonblocking; }
+                short blocked() { return _blocked; }
+                // For edge-triggered or one-shot interest: fill() reads until
+                // the socket would block or the get area is full, drain()
+                // sends until everything written has gone or the socket
+                // would block. Both return 1 when the socket would block, so
+                // the next edge (or re-armed one-shot) will report it ready
+                // again, 0 when it did not, so no edge is coming and the
+                // caller should not wait for one, and -1 on error or, for
+                // fill(), end of file.
+                int fill();
+                int drain();
+                // Submits sends and receives to engine, which must outlive the
+                // sockbuf; a null pointer leaves completion mode.
+                int completion(completion_engine *engine);
+                completion_engine *completion() { return _engine; }
+                // The counters kept for this stream, see io_stats.
+                io_stats stats() const { return _stats.snapshot(); }
+                
+                // Queues an external buffer behind the bytes already written,
+                // without copying it. The buffer must stay valid until
+                // pending() no longer counts it.
+                size_type append(const char_type *buf, size_type size);
+                // Queues count bytes of fd, starting at offset, to be sent with
+                // sendfile(2), or spliced when fd is a pipe and offset is
+                // ignored. A flush sets O_NONBLOCK on the socket while it
+                // sends file data, so it never blocks, and then restores the
+                // flags. fd must stay open while it is pending().
+                size_type appendfile(native_handle_type fd, off_t offset, size_type count);
+                size_type pending() { return _wbytes + (Base::pptr() - _pmark); }
+                // Bytes received and not yet read. Unlike in_avail() this
+                // never reads from the socket.
+                size_type buffered() { return Base::egptr() - Base::gptr(); }
+                
+                // Flushes of at least threshold bytes are sent with MSG_ZEROCOPY,
+                // a threshold of 0 turns this off. Appended buffers must then
+                // also outlive zerocopy_pending(), which counts the zerocopy
+                // sends the kernel has not yet released.
+                int zerocopy(size_type threshold);
+                size_type zerocopy_pending() { return _zcnext - _zcdone; }
                 
                 void pubsetopt(sockopt opt){ return setopt(opt); }
                 optval pubgetopt(sockopt opt){ return getopt(opt); }
+                // Sets or reads a typed option, see sockopts. Both return
+                // 0, or -1 with err() set.
+                template<int Level, int Name, class T>
+                int pubsetopt(const socket_option<Level, Name, T>& opt){
+                    if(::setsockopt(_socket, Level, Name, &opt.value, sizeof(T)) == 0) return 0;
+                    _errno = errno;
+                    return -1;
+                }
+                template<int Level, int Name, class T>
+                int pubgetopt(socket_option<Level, Name, T>& opt){
+                    socklen_t len = sizeof(T);
+                    if(::getsockopt(_socket, Level, Name, &opt.value, &len) == 0) return 0;
+                    _errno = errno;
+                    return -1;
+                }
 
                 int connectto(const struct sockaddr* addr, socklen_t addrlen);
                 
@@ -137,22 +479,77 @@ namespace io{
                 virtual void setopt(sockopt opt);
                 virtual optval getopt(sockopt opt);
             private:
+                // The requests outstanding in completion mode and everything
+                // the kernel may still read or write for them. It is shared
+                // with their completions, so a sockbuf destroyed or moved
+                // meanwhile hands its buffers over instead of freeing them.
+                struct completion_state {
+                    sockbuf *owner{nullptr};
+                    completion_engine::id_type send{0}, recv{0};
+                    struct msghdr smsg{}, rmsg{};
+                    std::vector<iovec> siov{};
+                    iovec riov{};
+                    struct sockaddr_storage saddr{}, raddr{};
+                    std::vector<char> scontrol{}, rcontrol{};
+                    std::vector<buffer> buffers{};
+                    vector_queue<buffer> retired{};
+                    ring_buffer ring{};
+                };
+                
                 size_type BUFSIZE;
                 std::ios_base::openmode _which{};
+                std::pmr::memory_resource *_resource{buffer_resource()};
                 std::vector<buffer> _buffers{};
+                ring_buffer _ring{};
+                vector_queue<buffer> _retired{};
+                buffer _spare = buffer(_resource);
+                write_queue _wqueue{};
+                vector_queue<zerocopy_type> _zcbufs{};
+                std::vector<iovec> _wiov{};
                 cbuf_array_t _cbufs{};
                 msghdr_array_t _msghdrs{};
+                batch_array_t _batches{};
                 storage_array _addresses{};
                 native_handle_type _socket{};
                 std::array<iovec, 2> _iov{};
+                char_type *_pmark{nullptr};
+                size_type _wbytes{0};
+                size_type _zcthreshold{0};
+                std::uint32_t _zcnext{0}, _zcdone{0};
                 int _errno;
                 bool _connected;
+                bool _lazy{false};
+                interest_type _interest{};
+                short _blocked{0};
+                bool _nonblocking{false};
+                stream_stats _stats{};
+                completion_engine *_engine{nullptr};
+                std::shared_ptr<completion_state> _cstate{};
+                bool _eof{false};
                 
                 void _init_buf_ptrs();
-                int _send(char_type *buf, size_type size);
+                int _wait(short events);
+                void _want(short events, bool enable);
+                int _reserve(std::ios_base::openmode which);
+                void _trim(std::ios_base::openmode which);
+                int _sync();
+                void _seal();
+                void _advance(size_type len);
+                buffer _swapwbuf();
+                void _release(buffer&& buf);
+                size_type _reap();
+                std::streamsize _sendfile();
+                int _send();
                 int _recv();
                 void _memmoverbuf();
                 void _resizewbuf();
+                bool _sending() { return _cstate && _cstate->send; }
+                bool _receiving() { return _cstate && _cstate->recv; }
+                int _submit_send();
+                int _submit_recv();
+                short _sent(int res);
+                short _received(int res);
+                void _abandon();
         };
     }
 }
@@ -0,0 +1,150 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "buffers.hpp"
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+namespace io{
+    namespace buffers{
+        static thread_local std::pmr::memory_resource *_buffer_resource = nullptr;
+
+        std::pmr::memory_resource *buffer_resource(){
+            return _buffer_resource ? _buffer_resource : std::pmr::get_default_resource();
+        }
+
+        std::pmr::memory_resource *buffer_resource(std::pmr::memory_resource *resource){
+            auto *previous = buffer_resource();
+            _buffer_resource = resource;
+            return previous;
+        }
+
+        buffer_pool::buffer_pool(bool hugepages):
+            _page{static_cast<std::size_t>(sysconf(_SC_PAGESIZE))},
+            _hugepages{hugepages}
+        {}
+
+        // Streams keep the resource they were built with, so a thread's
+        // pool is never destroyed. When the thread exits the pool is
+        // parked, buffers still drawn from it stay valid, and the next
+        // thread to ask for a pool adopts it, so there are never more pools
+        // than there were threads using them at once.
+        static std::mutex& _orphans_mutex(){
+            static auto *mutex = new std::mutex();
+            return *mutex;
+        }
+
+        static std::vector<buffer_pool*>& _orphans(){
+            static auto *orphans = new std::vector<buffer_pool*>();
+            return *orphans;
+        }
+
+        buffer_pool& buffer_pool::local(){
+            struct owner {
+                buffer_pool *pool{nullptr};
+                owner(){
+                    std::lock_guard<std::mutex> lock(_orphans_mutex());
+                    auto& orphans = _orphans();
+                    if(orphans.empty()) pool = new buffer_pool();
+                    else {
+                        pool = orphans.back();
+                        orphans.pop_back();
+                    }
+                }
+                ~owner(){
+                    std::lock_guard<std::mutex> lock(_orphans_mutex());
+                    _orphans().push_back(pool);
+                }
+            };
+            static thread_local owner local;
+            return *local.pool;
+        }
+
+        std::size_t buffer_pool::slabs(){
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _slabs.size();
+        }
+
+        // Classes 0-15 are 1 to 16 pages, above that they double
+        // until they no longer fit in a slab.
+        std::size_t buffer_pool::_class(std::size_t bytes){
+            std::size_t pages = (bytes + _page - 1) / _page;
+            if(pages <= 16) return pages ? pages - 1 : 0;
+            std::size_t cls = 16;
+            for(pages = (pages - 1) / 32; pages > 0; pages >>= 1) ++cls;
+            return cls;
+        }
+
+        std::size_t buffer_pool::_classsize(std::size_t cls){
+            if(cls < 16) return (cls + 1) * _page;
+            return (16 * _page) << (cls - 15);
+        }
+
+        char *buffer_pool::_map(std::size_t size){
+            void *addr = MAP_FAILED;
+            if(_hugepages && size % SLABSIZE == 0)
+                addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if(addr == MAP_FAILED){
+                addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(addr == MAP_FAILED) throw std::bad_alloc();
+                if(_hugepages) madvise(addr, size, MADV_HUGEPAGE);
+            }
+            return static_cast<char*>(addr);
+        }
+
+        void *buffer_pool::do_allocate(std::size_t bytes, std::size_t alignment){
+            if(alignment > _page) return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+            std::size_t cls = _class(bytes);
+            if(cls >= NCLASSES || _classsize(cls) > SLABSIZE)
+                return _map((bytes + _page - 1) / _page * _page);
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _carve(cls);
+        }
+
+        void *buffer_pool::_carve(std::size_t cls){
+            if(auto *blk = _free[cls]){
+                _free[cls] = blk->next;
+                return blk;
+            }
+            std::size_t size = _classsize(cls);
+            if(_end[cls] - _next[cls] < static_cast<std::ptrdiff_t>(size)){
+                _slabs.reserve(_slabs.size() + 1);
+                _slabs.push_back(_map(SLABSIZE));
+                _next[cls] = _slabs.back();
+                _end[cls] = _next[cls] + SLABSIZE;
+            }
+            char *p = _next[cls];
+            _next[cls] += size;
+            return p;
+        }
+
+        void buffer_pool::do_deallocate(void *p, std::size_t bytes, std::size_t alignment){
+            if(alignment > _page) return std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+            std::size_t cls = _class(bytes);
+            if(cls >= NCLASSES || _classsize(cls) > SLABSIZE){
+                munmap(p, (bytes + _page - 1) / _page * _page);
+                return;
+            }
+            auto *blk = static_cast<block*>(p);
+            std::lock_guard<std::mutex> lock(_mutex);
+            blk->next = _free[cls];
+            _free[cls] = blk;
+        }
+
+        buffer_pool::~buffer_pool(){
+            for(auto *slab: _slabs) munmap(slab, SLABSIZE);
+        }
+    }
+}
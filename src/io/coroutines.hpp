@@ -0,0 +1,276 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "io.hpp"
+#include <array>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <cerrno>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#pragma once
+#ifndef IO_COROUTINES
+#define IO_COROUTINES
+namespace io {
+	// Recycles coroutine frames. Frame sizes are rounded up to a multiple
+	// of GRANULE and freed frames are kept on per-thread free lists, so
+	// once a loop has warmed up, starting a coroutine does not touch the
+	// heap. Frames larger than the biggest class go to operator new.
+	class frame_pool {
+		public:
+			static constexpr std::size_t GRANULE = 64;
+			static constexpr std::size_t CLASSES = 32;
+			
+			static void *allocate(std::size_t size){
+				std::size_t cls = (size + GRANULE - 1) / GRANULE;
+				if(cls >= CLASSES) return ::operator new(size);
+				auto& head = _lists().heads[cls];
+				if(block *blk = head){
+					head = blk->next;
+					return blk;
+				}
+				return ::operator new(cls * GRANULE);
+			}
+			
+			static void deallocate(void *p, std::size_t size){
+				std::size_t cls = (size + GRANULE - 1) / GRANULE;
+				if(cls >= CLASSES) return ::operator delete(p);
+				auto& head = _lists().heads[cls];
+				auto *blk = static_cast<block*>(p);
+				blk->next = head;
+				head = blk;
+			}
+			
+		private:
+			struct block { block *next; };
+			struct free_lists {
+				std::array<block*, CLASSES> heads{};
+				~free_lists(){
+					for(auto *head: heads){
+						while(head){
+							block *next = head->next;
+							::operator delete(head);
+							head = next;
+						}
+					}
+				}
+			};
+			
+			static free_lists& _lists(){
+				static thread_local free_lists lists;
+				return lists;
+			}
+	};
+	
+	// A coroutine that starts running as soon as it is called and owns
+	// itself: its frame goes back to the frame_pool when it returns.
+	// Exceptions that escape it terminate, as they would a thread.
+	class task {
+		public:
+			struct promise_type {
+				task get_return_object() noexcept { return {}; }
+				std::suspend_never initial_suspend() noexcept { return {}; }
+				std::suspend_never final_suspend() noexcept { return {}; }
+				void return_void() noexcept {}
+				void unhandled_exception() noexcept { std::terminate(); }
+				
+				static void *operator new(std::size_t size){ return frame_pool::allocate(size); }
+				static void operator delete(void *p, std::size_t size){ frame_pool::deallocate(p, size); }
+			};
+	};
+	
+	// Resumes coroutines suspended on a trigger. Awaiting readable() or
+	// writable() adds interest in the handle to the trigger, and run_once()
+	// clears it again and resumes the coroutine once wait() has seen the
+	// handle become ready or report POLLERR, POLLHUP or POLLNVAL. The
+	// co_await yields the events reported, so the coroutine can tell an
+	// error from readiness. sleep_for() arms one of the trigger's timers.
+	// Coroutines are resumed after the trigger has finished polling, never
+	// from inside wait(). At most one coroutine may wait to read and one to
+	// write each handle. Coroutines still suspended when the loop is
+	// destroyed are neither resumed nor freed.
+	template<class TriggerT>
+	class basic_loop {
+		public:
+			using trigger_type = TriggerT;
+			using native_handle_type = typename trigger_type::native_handle_type;
+			using duration_type = typename trigger_type::duration_type;
+			using size_type = std::size_t;
+			using handle_type = std::coroutine_handle<>;
+			using sockstream = streams::sockstream;
+			
+			class io_awaiter {
+				public:
+					io_awaiter(basic_loop& loop, native_handle_type handle, short events, bool ready = false):
+						_loop{loop}, _handle{handle}, _events{events}, _revents{ready ? events : short{0}}, _ready{ready}{}
+					
+					bool await_ready() noexcept { return _ready; }
+					void await_suspend(handle_type coroutine){ _loop._suspend(_handle, _events, coroutine, &_revents); }
+					short await_resume() noexcept { return _revents; }
+				private:
+					basic_loop& _loop;
+					native_handle_type _handle;
+					short _events;
+					short _revents;
+					bool _ready;
+			};
+			
+			// Resumes with an accepted, non-blocking socket, or -1 with errno
+			// set. That includes EAGAIN when another thread took the
+			// connection first. The listener is switched to O_NONBLOCK.
+			class accept_awaiter {
+				public:
+					accept_awaiter(basic_loop& loop, native_handle_type listener):
+						_loop{loop}, _listener{listener}
+					{
+						int flags = fcntl(_listener, F_GETFL);
+						if(flags >= 0 && !(flags & O_NONBLOCK)) fcntl(_listener, F_SETFL, flags | O_NONBLOCK);
+					}
+					
+					bool await_ready() noexcept {
+						if((_socket = _accept()) >= 0) return true;
+						return errno != EAGAIN && errno != EWOULDBLOCK;
+					}
+					void await_suspend(handle_type coroutine){
+						_loop._suspend(_listener, POLLIN, coroutine, nullptr);
+						_suspended = true;
+					}
+					native_handle_type await_resume() noexcept {
+						if(_suspended) _socket = _accept();
+						return _socket;
+					}
+				private:
+					basic_loop& _loop;
+					native_handle_type _listener;
+					native_handle_type _socket{-1};
+					bool _suspended{false};
+					
+					native_handle_type _accept(){
+						native_handle_type socket;
+						while((socket = accept4(_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0 && errno == EINTR);
+						return socket;
+					}
+			};
+			
+			class sleep_awaiter {
+				public:
+					sleep_awaiter(basic_loop& loop, duration_type after):
+						_loop{loop}, _after{after}{}
+					
+					bool await_ready() noexcept { return _after.count() <= 0; }
+					void await_suspend(handle_type coroutine){
+						basic_loop *loop = &_loop;
+						_loop._trigger.timers().arm(_after, [loop, coroutine](){ loop->_runnable.push_back(coroutine); });
+						++_loop._suspended;
+					}
+					void await_resume() noexcept {}
+				private:
+					basic_loop& _loop;
+					duration_type _after;
+			};
+			
+			basic_loop(trigger_type& trigger): _trigger{trigger}{}
+			basic_loop(const basic_loop& other) = delete;
+			basic_loop& operator=(const basic_loop& other) = delete;
+			
+			io_awaiter readable(native_handle_type handle){ return {*this, handle, POLLIN}; }
+			io_awaiter writable(native_handle_type handle){ return {*this, handle, POLLOUT}; }
+			// Does not suspend while the stream's get area holds unread bytes.
+			io_awaiter readable(sockstream& stream){ return {*this, stream.native_handle(), POLLIN, stream.buffered() > 0}; }
+			io_awaiter writable(sockstream& stream){ return {*this, stream.native_handle(), POLLOUT}; }
+			accept_awaiter accept(native_handle_type listener){ return {*this, listener}; }
+			accept_awaiter accept(sockstream& listener){ return {*this, listener.native_handle()}; }
+			sleep_awaiter sleep_for(duration_type after){ return {*this, after}; }
+			
+			trigger_type& trigger() { return _trigger; }
+			// The number of coroutines waiting on a handle or a timer.
+			size_type suspended() { return _suspended; }
+			
+			// Waits once, for at most timeout, and resumes every coroutine
+			// whose handle became ready or whose timer expired. Returns how
+			// many were resumed.
+			size_type run_once(duration_type timeout = duration_type(-1)){
+				_trigger.wait(timeout);
+				_fired.clear();
+				for(auto& event: _trigger.ready())
+					_fired.push_back({io::native_handle(event), io::revents(event)});
+				for(auto& [handle, events]: _fired){
+					if(handle < 0 || static_cast<size_type>(handle) >= _waiters.size()) continue;
+					auto& waiter = _waiters[handle];
+					constexpr unsigned errors = POLLHUP | POLLERR | POLLNVAL;
+					short wake = 0;
+					if(waiter[0].coroutine && (events & (POLLIN | errors))) wake |= POLLIN;
+					if(waiter[1].coroutine && (events & (POLLOUT | errors))) wake |= POLLOUT;
+					if(!wake) continue;
+					short added = 0;
+					for(std::size_t i = 0; i < 2; ++i){
+						if(!(wake & (i ? POLLOUT : POLLIN))) continue;
+						if(waiter[i].revents) *waiter[i].revents = static_cast<short>(events);
+						added |= waiter[i].added;
+						_runnable.push_back(std::exchange(waiter[i], {}).coroutine);
+					}
+					if(added) _trigger.clear(handle, added);
+				}
+				size_type resumed = _runnable.size();
+				_suspended -= resumed;
+				_resuming.swap(_runnable);
+				for(auto coroutine: _resuming) coroutine.resume();
+				_resuming.clear();
+				return resumed;
+			}
+			
+			// Runs until no coroutine is left waiting.
+			void run(){
+				while(_suspended) run_once();
+			}
+			
+		private:
+			// added is the interest the waiter set, and the only interest
+			// it clears again; what the caller set on the handle is kept.
+			struct waiter {
+				handle_type coroutine{};
+				short *revents{nullptr};
+				short added{0};
+			};
+			using waiter_type = std::array<waiter, 2>;
+			using fired_type = std::pair<native_handle_type, unsigned>;
+			
+			trigger_type& _trigger;
+			std::vector<waiter_type> _waiters{};
+			std::vector<fired_type> _fired{};
+			std::vector<handle_type> _runnable{}, _resuming{};
+			size_type _suspended{0};
+			
+			void _suspend(native_handle_type handle, short events, handle_type coroutine, short *revents){
+				if(handle < 0) throw std::runtime_error("Invalid handle.");
+				if(static_cast<size_type>(handle) >= _waiters.size()) _waiters.resize(handle+1);
+				auto& slot = _waiters[handle][events & POLLIN ? 0 : 1];
+				if(slot.coroutine) throw std::runtime_error("A coroutine is already waiting on this handle.");
+				short added = static_cast<short>(events & ~_trigger.interest(handle));
+				if(added) _trigger.set(handle, added);
+				slot = {coroutine, revents, added};
+				++_suspended;
+			}
+	};
+	
+	using loop = basic_loop<trigger>;
+}
+#endif
@@ -0,0 +1,72 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "io.hpp"
+#if defined(__linux__)
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <unistd.h>
+namespace io{
+	epoller::epoller(): Base(){
+		if((_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) throw std::runtime_error("Unable to create epoll instance.");
+	}
+	
+	epoller::size_type epoller::_add(native_handle_type handle, events_type& events, event_type event){
+		if(epoll_ctl(_epfd, EPOLL_CTL_ADD, handle, &event)) return npos;
+		events.push_back({});
+		return events.size();
+	}
+	
+	epoller::size_type epoller::_update(native_handle_type handle, events_type& events, event_type event){
+		if(epoll_ctl(_epfd, EPOLL_CTL_MOD, handle, &event)) return npos;
+		return events.size();
+	}
+	
+	// The trigger has dropped the handle whatever epoll_ctl(2) returns, say
+	// when the descriptor was closed first, so the events shrink anyway.
+	epoller::size_type epoller::_del(native_handle_type handle, events_type& events){
+		int status = epoll_ctl(_epfd, EPOLL_CTL_DEL, handle, nullptr);
+		if(!events.empty()) events.pop_back();
+		if(_stale > events.size()) _stale = events.size();
+		return status ? npos : events.size();
+	}
+	
+	epoller::size_type epoller::_poll(duration_type timeout){ return epoller::_pwait(timeout, nullptr); }
+	
+	epoller::size_type epoller::_pwait(duration_type timeout, const signal_type *sigmask){
+		event_type *events = Base::events();
+		int maxevents = static_cast<int>(Base::size());
+		event_type unused = {};
+		if(maxevents == 0) {
+			events = &unused;
+			maxevents = 1;
+		}
+		int nfds = 0;
+		if((nfds = epoll_pwait(_epfd, events, maxevents, timeout.count(), sigmask)) < 0) return npos;
+		if(events == &unused) return 0;
+		for(size_type i = nfds; i < _stale; ++i) events[i] = {};
+		_stale = nfds;
+		return nfds;
+	}
+	
+	epoller::~epoller(){
+		if(_epfd > 2) close(_epfd);
+	}
+	
+	etrigger::event_type etrigger::mkevent(native_handle_type handle, trigger_type trigger){
+		return make_event<event_type>(handle, trigger);
+	}
+}
+#endif
@@ -16,17 +16,33 @@
 #include "buffers.hpp"
 #include "streams.hpp"
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
 #include <tuple>
+#include <utility>
 #include <vector>
+#include <cerrno>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <poll.h>
 #include <signal.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#endif
 
 #pragma once
 #ifndef IO
 #define IO
+#if defined(__linux__)
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
 namespace io {
 	struct poll_t {
 		using event_type = struct pollfd;
@@ -34,13 +50,27 @@ namespace io {
 		using event_mask = short;
 	};
 	
+#if defined(__linux__)
+	struct epoll_t {
+		using event_type = struct epoll_event;
+		using events_type = std::vector<event_type>;
+		using event_mask = std::uint32_t;
+	};
+	
+	struct uring_t {
+		using event_type = struct pollfd;
+		using events_type = std::vector<event_type>;
+		using event_mask = short;
+	};
+#endif
+	
 	template<class PollT>
 	struct poll_traits{
 		using native_handle_type = int;
 		using signal_type = sigset_t;
 		using size_type = std::size_t;
 		using duration_type = std::chrono::milliseconds;
-		static const size_type npos = -1;
+		static constexpr size_type npos = -1;
 		// data types specific to the polling implementation need to be
 		// specified in a specialization.
 	};
@@ -54,12 +84,176 @@ namespace io {
 		using event_type = poll_t::event_type;
 		using events_type = poll_t::events_type;
 		using event_mask = poll_t::event_mask;
-		static const size_type npos = -1;
+		static constexpr size_type npos = -1;
 	};
+	
+#if defined(__linux__)
+	template<>
+	struct poll_traits<epoll_t> {
+		using native_handle_type = int;
+		using signal_type = sigset_t;
+		using size_type = std::size_t;
+		using duration_type = std::chrono::milliseconds;
+		using event_type = epoll_t::event_type;
+		using events_type = epoll_t::events_type;
+		using event_mask = epoll_t::event_mask;
+		static constexpr size_type npos = -1;
+	};
+	
+	template<>
+	struct poll_traits<uring_t> {
+		using native_handle_type = int;
+		using signal_type = sigset_t;
+		using size_type = std::size_t;
+		using duration_type = std::chrono::milliseconds;
+		using event_type = uring_t::event_type;
+		using events_type = uring_t::events_type;
+		using event_mask = uring_t::event_mask;
+		static constexpr size_type npos = -1;
+	};
+#endif
 
+	inline bool ready(const struct pollfd& event) { return event.revents; }
+	inline int native_handle(const struct pollfd& event) { return event.fd; }
+	inline unsigned revents(const struct pollfd& event) { return static_cast<unsigned short>(event.revents); }
+#if defined(__linux__)
+	inline bool ready(const struct epoll_event& event) { return event.events; }
+	inline int native_handle(const struct epoll_event& event) { return event.data.fd; }
+	inline unsigned revents(const struct epoll_event& event) { return event.events; }
+#endif
+	
+	// Trigger bits that choose how epoll reports a handle rather than
+	// which events it reports. They never count as interest on their own.
+#if defined(__linux__)
+	inline constexpr std::uint32_t trigger_modes = EPOLLET | EPOLLONESHOT | EPOLLEXCLUSIVE | EPOLLWAKEUP;
+#else
+	inline constexpr std::uint32_t trigger_modes = 0;
+#endif
+	
+	// The native event registering trigger for handle.
+	template<class EventT>
+	EventT make_event(int handle, std::uint32_t trigger);
+	
+	// poll(2) and io_uring have no trigger modes, their bits are dropped.
+	template<>
+	inline struct pollfd make_event<struct pollfd>(int handle, std::uint32_t trigger){
+		struct pollfd event = {};
+		event.fd = handle;
+		event.events = static_cast<short>(trigger & ~trigger_modes);
+		return event;
+	}
+#if defined(__linux__)
+	template<>
+	inline struct epoll_event make_event<struct epoll_event>(int handle, std::uint32_t trigger){
+		struct epoll_event event = {};
+		event.events = trigger;
+		event.data.fd = handle;
+		return event;
+	}
+#endif
+	
+	// Non-owning view over an array of native events. Iteration skips
+	// entries that are not ready and stops as soon as the number of ready
+	// events reported by the last wait has been seen.
+	template<class EventT>
+	class basic_events_view {
+		public:
+			using event_type = EventT;
+			using size_type = std::size_t;
+			
+			class iterator {
+				public:
+					using iterator_category = std::forward_iterator_tag;
+					using value_type = event_type;
+					using difference_type = std::ptrdiff_t;
+					using pointer = event_type*;
+					using reference = event_type&;
+					
+					iterator() = default;
+					iterator(event_type *it, event_type *end, size_type remaining):
+						_it{it}, _end{end}, _remaining{remaining}
+					{ _next(); }
+					
+					reference operator*() const { return *_it; }
+					pointer operator->() const { return _it; }
+					iterator& operator++() {
+						if(--_remaining == 0) _it = _end;
+						else {
+							++_it;
+							_next();
+						}
+						return *this;
+					}
+					iterator operator++(int) { iterator tmp = *this; ++(*this); return tmp; }
+					bool operator==(const iterator& other) const { return _it == other._it; }
+					bool operator!=(const iterator& other) const { return _it != other._it; }
+					
+				private:
+					event_type *_it{nullptr}, *_end{nullptr};
+					size_type _remaining{0};
+					
+					void _next() {
+						if(_remaining == 0) _it = _end;
+						while(_it != _end && !ready(*_it)) ++_it;
+					}
+			};
+			
+			basic_events_view(event_type *events, size_type size, size_type nready):
+				_events{events}, _size{size}, _nready{nready < size ? nready : size}
+			{}
+			
+			iterator begin() const { return iterator(_events, _events + _size, _nready); }
+			iterator end() const { return iterator(_events + _size, _events + _size, 0); }
+			size_type size() const { return _nready; }
+			bool empty() const { return _nready == 0; }
+			
+		private:
+			event_type *_events;
+			size_type _size, _nready;
+	};
+
+#if defined(__linux__)
+	// A multi-producer, single-consumer queue of tasks for one event loop,
+	// with an eventfd(2) to wake the loop. post() may be called from any
+	// thread: it pushes the task onto a lock-free stack and only writes
+	// the eventfd when the loop has not been woken since it last ran the
+	// queue, so a burst of posts costs a single wakeup. run() is called on
+	// the loop's thread, by a trigger the queue is attached to after each
+	// wait, and runs the tasks in the order they were posted.
+	class task_queue {
+		public:
+			using native_handle_type = int;
+			using size_type = std::size_t;
+			using task_type = std::function<void()>;
+			
+			task_queue();
+			task_queue(const task_queue& other) = delete;
+			task_queue& operator=(const task_queue& other) = delete;
+			
+			native_handle_type native_handle() { return _fd; }
+			// Returns 0, or -1 when the loop could not be woken.
+			int post(task_type task);
+			// Runs every task posted so far and returns how many ran. Costs
+			// one atomic load when nothing has been posted.
+			size_type run();
+			
+			~task_queue();
+			
+		private:
+			struct node_type {
+				task_type task;
+				node_type *next;
+			};
+			std::atomic<node_type*> _head{nullptr};
+			std::atomic<bool> _signalled{false};
+			native_handle_type _fd{-1};
+	};
+#endif
+	
 	template<class PollT, class Traits = poll_traits<PollT> >
 	class basic_poller {
 		public:
+			using poll_type = PollT;
 			using native_handle_type = typename Traits::native_handle_type;
 			using signal_type = typename Traits::signal_type;
 			using size_type = typename Traits::size_type;
@@ -67,9 +261,12 @@ namespace io {
 			using event_type = typename Traits::event_type;
 			using events_type = typename Traits::events_type;
 			using event_mask = typename Traits::event_mask;
-			static const size_type npos = Traits::npos;
+			static constexpr size_type npos = Traits::npos;
 			
-			size_type operator()(duration_type timeout = duration_type(0)){ return _poll(timeout); }
+			size_type operator()(duration_type timeout = duration_type(0)){ return _setready(_poll(timeout)); }
+			// Waits with sigmask as the thread's signal mask, which is put in
+			// place and restored atomically around the wait as by ppoll(2).
+			size_type operator()(duration_type timeout, const signal_type& sigmask){ return _setready(_pwait(timeout, &sigmask)); }
 			
 			size_type add(native_handle_type handle, event_type event){ return _add(handle, _events, event); }
 			size_type update(native_handle_type handle, event_type event){ return _update(handle, _events, event); }
@@ -77,6 +274,14 @@ namespace io {
 			
 			event_type* events() { return _events.data(); }
 			size_type size() { return _events.size(); }
+			size_type nready() { return _nready; }
+			// Events that belong to no registration, such as the results of
+			// completion requests, reported by the last wait after events().
+			event_type* completions() { return _completions.data(); }
+			size_type ncompletions() { return _completions.size(); }
+			// Makes room for n events, growing geometrically so that
+			// repeated batches don't reallocate every time.
+			void reserve(size_type n){ if(n > _events.capacity()) _events.reserve(std::max(n, 2*_events.capacity())); }
 			
 			virtual ~basic_poller() = default;
 		protected:
@@ -85,9 +290,19 @@ namespace io {
 			virtual size_type _update(native_handle_type handle, events_type& events, event_type event) { return npos; }
 			virtual size_type _del(native_handle_type handle, events_type& events ) { return npos; }
 			virtual size_type _poll(duration_type timeout) { return npos; }
+			virtual size_type _pwait(duration_type timeout, const signal_type *sigmask) { return npos; }
+			
+			events_type& _eventlist() { return _events; }
+			events_type& _completionlist() { return _completions; }
+			size_type _setready(size_type nready){
+				_nready = (nready == npos) ? 0 : nready;
+				return nready;
+			}
 			
 		private:
 			events_type _events{};
+			events_type _completions{};
+			size_type _nready{0};
 	};
 	
 	class poller: public basic_poller<poll_t> {
@@ -107,12 +322,457 @@ namespace io {
 			size_type _update(native_handle_type handle, events_type& events, event_type event) override;
 			size_type _del(native_handle_type handle, events_type& events ) override;
 			size_type _poll(duration_type timeout) override;
+			size_type _pwait(duration_type timeout, const signal_type *sigmask) override;
+			
+		private:
+			// Maps a handle to its position in the pollfd array. Removal
+			// swaps the last pollfd into the vacated slot.
+			std::vector<size_type> _index{};
 	};
 	
-	template<class PollT, class Traits = poll_traits<PollT> >
-	class basic_trigger {
+#if defined(__linux__)
+	// The epoll interest list lives in the kernel, so the events array
+	// is only a landing area for ready events. It is kept as long as the
+	// number of registered handles and entries past the last ready event
+	// are always zeroed, so callers that scan the whole array still only
+	// see the events reported by the last wait.
+	class epoller: public basic_poller<epoll_t> {
 		public:
-			using poller_type = basic_poller<PollT>;
+			using Base = basic_poller<epoll_t>;
+			using size_type = Base::size_type;
+			using duration_type = Base::duration_type;
+			using event_type = Base::event_type;
+			using events_type = Base::events_type;
+			using event_mask = Base::event_mask;
+			
+			epoller();
+			epoller(const epoller& other) = delete;
+			epoller& operator=(const epoller& other) = delete;
+			
+			native_handle_type native_handle() { return _epfd; }
+			~epoller();
+			
+		protected:
+			size_type _add(native_handle_type handle, events_type& events, event_type event) override;
+			size_type _update(native_handle_type handle, events_type& events, event_type event) override;
+			size_type _del(native_handle_type handle, events_type& events ) override;
+			size_type _poll(duration_type timeout) override;
+			size_type _pwait(duration_type timeout, const signal_type *sigmask) override;
+			
+		private:
+			native_handle_type _epfd{-1};
+			size_type _stale{0};
+	};
+	
+	// Completion based poller built on io_uring. Interest changes are
+	// queued on the submission ring and only handed to the kernel together
+	// with the next wait, so any number of changes costs a single
+	// io_uring_enter. Ready events are reaped from the completion ring
+	// into the events array as pollfd entries, with the same zeroed tail
+	// as the epoller. Single-shot polls are re-armed as they complete,
+	// which keeps the level-triggered semantics of poll() but queues one
+	// submission per reported handle for the next wait. Multishot polls
+	// stay armed and only complete on new wakeups, and should only be used
+	// by callers that drain their handles.
+	//
+	// It is also the completion engine of sockbufs in completion mode:
+	// their sends and receives go through the same rings, are submitted
+	// with the next wait, and the handle is reported with the events their
+	// completions return in completions(), which the trigger reports after
+	// the readiness events. A handle registered
+	// for readiness as well can then be reported twice by one wait.
+	// Multishot receive and accept and provided buffer rings are not
+	// implemented.
+	class upoller: public basic_poller<uring_t>, public buffers::completion_engine {
+		public:
+			using Base = basic_poller<uring_t>;
+			using size_type = Base::size_type;
+			using duration_type = Base::duration_type;
+			using event_type = Base::event_type;
+			using events_type = Base::events_type;
+			using event_mask = Base::event_mask;
+			using interest_type = std::tuple<event_mask, std::uint32_t>;
+			using interest_list = std::vector<interest_type>;
+			using id_type = buffers::completion_engine::id_type;
+			using done_type = buffers::completion_engine::done_type;
+			static constexpr unsigned DEFAULT_ENTRIES = 256;
+			
+			explicit upoller(bool multishot = false, unsigned entries = DEFAULT_ENTRIES);
+			upoller(const upoller& other) = delete;
+			upoller& operator=(const upoller& other) = delete;
+			
+			native_handle_type native_handle() { return _ringfd; }
+			id_type sendmsg(int handle, const struct msghdr *msg, int flags, done_type done) override;
+			id_type recvmsg(int handle, struct msghdr *msg, int flags, done_type done) override;
+			void cancel(id_type id) override;
+			// Requests submitted and not yet completed.
+			size_type outstanding() { return _outstanding; }
+			// Requests still outstanding are cancelled and waited for, and
+			// their completions are not called.
+			~upoller();
+			
+		protected:
+			size_type _add(native_handle_type handle, events_type& events, event_type event) override;
+			size_type _update(native_handle_type handle, events_type& events, event_type event) override;
+			size_type _del(native_handle_type handle, events_type& events ) override;
+			size_type _poll(duration_type timeout) override;
+			size_type _pwait(duration_type timeout, const signal_type *sigmask) override;
+			
+		private:
+			native_handle_type _ringfd{-1};
+			void *_sq_ptr{nullptr}, *_cq_ptr{nullptr};
+			std::size_t _sq_size{0}, _cq_size{0}, _sqes_size{0};
+			unsigned *_sq_head{nullptr}, *_sq_tail{nullptr}, *_sq_mask{nullptr};
+			unsigned *_cq_head{nullptr}, *_cq_tail{nullptr}, *_cq_mask{nullptr};
+			unsigned _sq_entries{0}, _pending{0};
+			struct io_uring_sqe *_sqes{nullptr};
+			struct io_uring_cqe *_cqes{nullptr};
+			interest_list _interest{};
+			size_type _stale{0};
+			bool _multishot{false}, _ext_arg{false};
+			// Completion requests live in reused slots, and the generation
+			// tells a completion from one for an earlier use of the slot.
+			struct request_type {
+				done_type done{};
+				native_handle_type handle{-1};
+				std::uint32_t gen{0};
+			};
+			std::vector<request_type> _requests{};
+			std::vector<std::uint32_t> _free{};
+			std::vector<std::tuple<std::uint32_t, int> > _completed{};
+			events_type _reaped{};
+			size_type _outstanding{0};
+			
+			struct io_uring_sqe *_getsqe();
+			int _submit(unsigned min_complete, unsigned flags, void *arg, std::size_t argsz);
+			void _arm(native_handle_type handle);
+			void _disarm(native_handle_type handle);
+			id_type _request(std::uint8_t opcode, native_handle_type handle, struct msghdr *msg, int flags, done_type done);
+			int _enter(duration_type timeout, const signal_type *sigmask);
+			void _reap();
+	};
+#endif
+	
+	// A backend whose hooks are called by their qualified names rather
+	// than through the vtable, so every call is bound at compile time.
+	// It is meant to be held by value, see basic_static_trigger.
+	template<class BackendT>
+	class static_poller final: public BackendT {
+		public:
+			using Base = BackendT;
+			using native_handle_type = typename Base::native_handle_type;
+			using size_type = typename Base::size_type;
+			using duration_type = typename Base::duration_type;
+			using event_type = typename Base::event_type;
+			using signal_type = typename Base::signal_type;
+			using Base::Base;
+			
+			size_type operator()(duration_type timeout = duration_type(0)){ return Base::_setready(Base::_poll(timeout)); }
+			size_type operator()(duration_type timeout, const signal_type& sigmask){ return Base::_setready(Base::_pwait(timeout, &sigmask)); }
+			size_type add(native_handle_type handle, event_type event){ return Base::_add(handle, Base::_eventlist(), event); }
+			size_type update(native_handle_type handle, event_type event){ return Base::_update(handle, Base::_eventlist(), event); }
+			size_type del(native_handle_type handle) { return Base::_del(handle, Base::_eventlist()); }
+	};
+	
+	// Hierarchical timing wheel with four levels of 256 slots, one tick per
+	// unit of DurationT. Timers live in a recycled node pool and are linked
+	// into their slot, so arming and cancelling are O(1) and allocation free
+	// once the pool has grown. Timers further out than the wheel can hold
+	// are clamped to its horizon.
+	template<class DurationT, class ClockT = std::chrono::steady_clock>
+	class basic_timer_wheel {
+		public:
+			using duration_type = DurationT;
+			using clock_type = ClockT;
+			using size_type = std::size_t;
+			using timer_id = std::uint64_t;
+			using callback_type = std::function<void()>;
+			static constexpr timer_id npos = -1;
+			static constexpr unsigned LEVELS = 4;
+			static constexpr unsigned SLOTS = 256;
+			
+			basic_timer_wheel(): _start{clock_type::now()} { _heads.fill(NIL); }
+			
+			timer_id arm(duration_type after, callback_type callback){
+				if(_count == 0) _now = _ticks();
+				std::int64_t delay = after.count() < 0 ? 0 : after.count();
+				std::uint32_t idx = _alloc();
+				auto& node = _nodes[idx];
+				node.callback = std::move(callback);
+				node.expiry = _ticks() + delay;
+				if(node.expiry <= _now) node.expiry = _now + 1;
+				_link(idx);
+				++_count;
+				return (static_cast<timer_id>(node.gen) << 32) | idx;
+			}
+			
+			bool cancel(timer_id id){
+				std::uint32_t idx = static_cast<std::uint32_t>(id);
+				if(id == npos || idx >= _nodes.size()) return false;
+				auto& node = _nodes[idx];
+				if(node.gen != (id >> 32) || node.slot == NIL) return false;
+				_unlink(idx);
+				_free(idx);
+				--_count;
+				return true;
+			}
+			
+			// Time left until the wheel next needs to be advanced, or a
+			// negative duration when no timers are armed.
+			duration_type next(){
+				if(_count == 0) return duration_type(-1);
+				std::uint64_t at = _nextevent();
+				std::uint64_t now = _ticks();
+				return duration_type(at > now ? at - now : 0);
+			}
+			
+			// Runs every timer that has expired, and returns how many ran.
+			size_type advance(){
+				size_type fired = 0;
+				std::uint64_t now = _ticks();
+				while(_count && _now < now){
+					std::uint64_t at = _nextevent();
+					if(at > now) break;
+					_now = at;
+					for(unsigned level = LEVELS-1; level > 0; --level){
+						if(_now & ((std::uint64_t(1) << (8*level)) - 1)) continue;
+						_cascade(level, (_now >> (8*level)) & (SLOTS-1));
+					}
+					auto& head = _heads[_now & (SLOTS-1)];
+					while(head != NIL){
+						std::uint32_t idx = head;
+						callback_type callback = std::move(_nodes[idx].callback);
+						_unlink(idx);
+						_free(idx);
+						--_count;
+						++fired;
+						if(callback) callback();
+					}
+				}
+				if(_now < now) _now = now;
+				return fired;
+			}
+			
+			size_type size() { return _count; }
+			
+		private:
+			static constexpr std::uint32_t NIL = -1;
+			static constexpr std::uint64_t HORIZON = (std::uint64_t(1) << (8*LEVELS)) - 1;
+			
+			struct node_type {
+				callback_type callback{};
+				std::uint64_t expiry{0};
+				std::uint32_t prev{NIL}, next{NIL}, slot{NIL}, gen{0};
+			};
+			
+			std::vector<node_type> _nodes{};
+			std::array<std::uint32_t, LEVELS*SLOTS> _heads{};
+			std::array<std::array<std::uint64_t, SLOTS/64>, LEVELS> _bitmap{};
+			typename clock_type::time_point _start;
+			std::uint64_t _now{0};
+			std::uint32_t _freelist{NIL};
+			size_type _count{0};
+			
+			std::uint64_t _ticks(){ return std::chrono::duration_cast<duration_type>(clock_type::now() - _start).count(); }
+			
+			std::uint32_t _alloc(){
+				if(_freelist == NIL){
+					_nodes.emplace_back();
+					return _nodes.size()-1;
+				}
+				std::uint32_t idx = _freelist;
+				_freelist = _nodes[idx].next;
+				return idx;
+			}
+			
+			void _free(std::uint32_t idx){
+				auto& node = _nodes[idx];
+				node.callback = nullptr;
+				++node.gen;
+				node.next = _freelist;
+				_freelist = idx;
+			}
+			
+			void _link(std::uint32_t idx){
+				auto& node = _nodes[idx];
+				if(node.expiry - _now > HORIZON) node.expiry = _now + HORIZON;
+				std::uint64_t delta = node.expiry - _now;
+				unsigned level = 0;
+				while(level < LEVELS-1 && delta >= (std::uint64_t(1) << (8*(level+1)))) ++level;
+				unsigned slot = (node.expiry >> (8*level)) & (SLOTS-1);
+				node.slot = level*SLOTS + slot;
+				node.prev = NIL;
+				node.next = _heads[node.slot];
+				if(node.next != NIL) _nodes[node.next].prev = idx;
+				_heads[node.slot] = idx;
+				_bitmap[level][slot/64] |= std::uint64_t(1) << (slot%64);
+			}
+			
+			void _unlink(std::uint32_t idx){
+				auto& node = _nodes[idx];
+				if(node.prev != NIL) _nodes[node.prev].next = node.next;
+				else _heads[node.slot] = node.next;
+				if(node.next != NIL) _nodes[node.next].prev = node.prev;
+				if(_heads[node.slot] == NIL){
+					unsigned level = node.slot / SLOTS, slot = node.slot % SLOTS;
+					_bitmap[level][slot/64] &= ~(std::uint64_t(1) << (slot%64));
+				}
+				node.slot = NIL;
+			}
+			
+			void _cascade(unsigned level, unsigned slot){
+				std::uint32_t idx = _heads[level*SLOTS + slot];
+				while(idx != NIL){
+					std::uint32_t next = _nodes[idx].next;
+					_unlink(idx);
+					_link(idx);
+					idx = next;
+				}
+			}
+			
+			// Slots between the current position and the first occupied slot
+			// of a level, counting from the slot after the current one.
+			unsigned _distance(unsigned level){
+				unsigned cur = (_now >> (8*level)) & (SLOTS-1);
+				for(unsigned i = 1; i <= SLOTS; ++i){
+					unsigned slot = (cur + i) & (SLOTS-1);
+					std::uint64_t word = _bitmap[level][slot/64] >> (slot%64);
+					if(!word){
+						i += 63 - slot%64;
+						continue;
+					}
+					i += __builtin_ctzll(word);
+					if(i <= SLOTS) return i;
+				}
+				return 0;
+			}
+			
+			// The next tick at which a timer fires or a higher level slot has
+			// to be cascaded.
+			std::uint64_t _nextevent(){
+				std::uint64_t at = UINT64_MAX;
+				for(unsigned level = 0; level < LEVELS; ++level){
+					unsigned distance = _distance(level);
+					if(!distance) continue;
+					std::uint64_t tick = ((_now >> (8*level)) + distance) << (8*level);
+					if(tick < at) at = tick;
+				}
+				return at;
+			}
+	};
+	
+	// Log-linear histogram in the style of HdrHistogram: values below 16
+	// have a bucket each, and every power of two above that is split into
+	// 16 buckets, so any recorded value is known to within 1/16th. Only
+	// one thread may record into a histogram, but its counters are relaxed
+	// atomics, so any thread can copy or merge it while it is in use.
+	class histogram {
+		public:
+			static constexpr unsigned SUB_BITS = 4;
+			static constexpr unsigned SUBS = 1u << SUB_BITS;
+			static constexpr std::size_t NBUCKETS = (64 - SUB_BITS + 1) * SUBS;
+			
+			histogram() = default;
+			histogram(const histogram& other) { *this += other; }
+			histogram& operator=(const histogram& other){
+				if(this == &other) return *this;
+				reset();
+				return *this += other;
+			}
+			
+			void record(std::uint64_t value){
+				_add(_buckets[_bucket(value)], 1);
+				_add(_count, 1);
+				if(value > _max.load(std::memory_order_relaxed)) _max.store(value, std::memory_order_relaxed);
+			}
+			
+			std::uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+			std::uint64_t max() const { return _max.load(std::memory_order_relaxed); }
+			
+			// The smallest value that at least the fraction q of all recorded
+			// values are no greater than, rounded up to the top of its bucket.
+			std::uint64_t quantile(double q) const {
+				std::uint64_t total = count();
+				if(total == 0) return 0;
+				std::uint64_t rank = q * total;
+				if(rank < q * total) ++rank;
+				if(rank == 0) rank = 1;
+				std::uint64_t seen = 0;
+				for(std::size_t i = 0; i < NBUCKETS; ++i){
+					seen += _buckets[i].load(std::memory_order_relaxed);
+					if(seen >= rank) return std::min(_highest(i), max());
+				}
+				return max();
+			}
+			
+			histogram& operator+=(const histogram& other){
+				for(std::size_t i = 0; i < NBUCKETS; ++i)
+					_add(_buckets[i], other._buckets[i].load(std::memory_order_relaxed));
+				_add(_count, other.count());
+				if(other.max() > max()) _max.store(other.max(), std::memory_order_relaxed);
+				return *this;
+			}
+			
+			void reset(){
+				for(auto& bucket: _buckets) bucket.store(0, std::memory_order_relaxed);
+				_count.store(0, std::memory_order_relaxed);
+				_max.store(0, std::memory_order_relaxed);
+			}
+			
+		private:
+			std::array<std::atomic<std::uint64_t>, NBUCKETS> _buckets{};
+			std::atomic<std::uint64_t> _count{0}, _max{0};
+			
+			static void _add(std::atomic<std::uint64_t>& counter, std::uint64_t n){
+				counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+			}
+			
+			static std::size_t _bucket(std::uint64_t value){
+				if(value < SUBS) return value;
+				unsigned exp = 63 - __builtin_clzll(value);
+				return (exp - SUB_BITS + 1) * SUBS + ((value >> (exp - SUB_BITS)) - SUBS);
+			}
+			
+			static std::uint64_t _highest(std::size_t bucket){
+				if(bucket < SUBS) return bucket;
+				unsigned shift = bucket / SUBS - 1;
+				std::uint64_t lowest = (SUBS + bucket % SUBS) << shift;
+				return lowest + ((std::uint64_t(1) << shift) - 1);
+			}
+	};
+	
+	// The histograms kept for one event loop, see basic_trigger::record()
+	// and basic_handler::record(). Durations are in nanoseconds: how long
+	// each wait blocked, how far a wait that timed out overran its timeout,
+	// and how long after a wait returned the handler finished with its
+	// events. ready counts the events each wait returned. Keep one per
+	// thread and merge them with += to see the whole process.
+	struct loop_stats {
+		histogram wait{}, ready{}, dispatch{}, overrun{};
+		std::uint64_t ready_at{0};
+		
+		static std::uint64_t now(){
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()
+			).count();
+		}
+		
+		loop_stats& operator+=(const loop_stats& other){
+			wait += other.wait;
+			ready += other.ready;
+			dispatch += other.dispatch;
+			overrun += other.overrun;
+			return *this;
+		}
+	};
+	
+	// The interest list, timers and loop statistics behind a trigger.
+	// Derived hands over its poller with _backend() and builds native
+	// events with _mkevent(), and decides whether either is virtual.
+	template<class Derived, class PollerT, class Traits>
+	class basic_trigger_base {
+		public:
+			using poller_type = PollerT;
 			using native_handle_type = typename Traits::native_handle_type;
 			using signal_type = typename Traits::signal_type;
 			using size_type = typename Traits::size_type;
@@ -123,49 +783,221 @@ namespace io {
 			using trigger_type = std::uint32_t;
 			using interest_type = std::tuple<native_handle_type, trigger_type>;
 			using interest_list = std::vector<interest_type>;
-			static const size_type npos = Traits::npos;
-			
-			basic_trigger(poller_type& poller): _poller{poller}{}
+			using index_type = std::vector<size_type>;
+			using events_view = basic_events_view<event_type>;
+			using timers_type = basic_timer_wheel<duration_type>;
+			static constexpr size_type npos = Traits::npos;
 			
+			// Adds trigger to the interest held for handle. With the epoll
+			// backend it may include EPOLLET for edge-triggered or
+			// EPOLLONESHOT for one-shot interest; backends without them
+			// drop those bits and stay level-triggered.
 			size_type set(native_handle_type handle, trigger_type trigger){
-				auto it = std::find_if(_list.begin(), _list.end(), [&](interest_type& i){ return std::get<native_handle_type>(i) == handle; });
-				if(it != _list.end()){
-					trigger_type& trigger_ = std::get<trigger_type>(*it);
+				if(handle < 0) return npos;
+				if(static_cast<size_type>(handle) >= _index.size()) _index.resize(handle+1, npos);
+				size_type& idx = _index[handle];
+				if(idx != npos){
+					trigger_type& trigger_ = std::get<trigger_type>(_list[idx]);
 					trigger_ |= trigger;
-					return _poller.update(handle, mkevent(handle, trigger_));
+					return _poller().update(handle, _event(handle, trigger_));
 				} else {
+					idx = _list.size();
 					_list.push_back({handle, trigger});
-					return _poller.add(handle, mkevent(handle, trigger));
+					return _poller().add(handle, _event(handle, trigger));
 				}
 			}
+			// As set(), for every handle in [first, last), with the index,
+			// the interest list and the poller's events grown once for the
+			// batch. poll and io_uring register each handle without a
+			// syscall, io_uring submitting the polls together on the next
+			// wait, but epoll has no batched epoll_ctl(2) and still makes
+			// one call per handle. Returns the handles set.
+			template<class It>
+			size_type set(It first, It last, trigger_type trigger){
+				size_type count = 0;
+				native_handle_type top = -1;
+				for(It it = first; it != last; ++it, ++count) top = std::max<native_handle_type>(top, *it);
+				if(top >= 0 && static_cast<size_type>(top) >= _index.size()) _index.resize(top+1, npos);
+				if(_list.size() + count > _list.capacity()) _list.reserve(std::max(_list.size() + count, 2*_list.capacity()));
+				_poller().reserve(_poller().size() + count);
+				count = 0;
+				for(; first != last; ++first) if(set(*first, trigger) != npos) ++count;
+				return count;
+			}
 			
+			// Removes trigger from the interest held for handle, and the
+			// handle itself once no events are left, whatever trigger modes
+			// remain.
 			size_type clear(native_handle_type handle, trigger_type trigger = UINT32_MAX){
-				auto it = std::find_if(_list.begin(), _list.end(), [&](interest_type& i){ return std::get<native_handle_type>(i) == handle; });
-				if(it == _list.end()) return npos;
-				trigger_type& trigger_ = std::get<trigger_type>(*it);
+				if(handle < 0 || static_cast<size_type>(handle) >= _index.size()) return npos;
+				size_type& idx = _index[handle];
+				if(idx == npos) return npos;
+				trigger_type& trigger_ = std::get<trigger_type>(_list[idx]);
 				trigger_ &= ~trigger;
-				if(trigger_) return _poller.update(handle, mkevent(handle, trigger_));
-				_list.erase(it);
-				return _poller.del(handle);
+				if(trigger_ & ~trigger_modes) return _poller().update(handle, _event(handle, trigger_));
+				auto& back = _list.back();
+				_index[std::get<native_handle_type>(back)] = idx;
+				_list[idx] = back;
+				_list.pop_back();
+				idx = npos;
+				return _poller().del(handle);
+			}
+			
+			// Hands the interest held for handle to the poller again, which
+			// re-enables a one-shot registration after it has fired.
+			size_type rearm(native_handle_type handle){
+				if(handle < 0 || static_cast<size_type>(handle) >= _index.size()) return npos;
+				size_type idx = _index[handle];
+				if(idx == npos) return npos;
+				return _poller().update(handle, _event(handle, std::get<trigger_type>(_list[idx])));
+			}
+			
+			// The timeout is shortened to the next timer expiry, and expired
+			// timers are run once the poller returns.
+			size_type wait(duration_type timeout = duration_type(0)){ return _wait(timeout, nullptr); }
+			// As wait(), but with sigmask as the thread's signal mask while
+			// it blocks, see ppoll(2). Signals kept blocked everywhere else
+			// can then only interrupt the loop here. A poll or epoll wait
+			// they interrupt returns npos with errno set to EINTR, an
+			// io_uring wait returns what has completed, and only applies
+			// the mask when it actually blocks.
+			size_type wait(duration_type timeout, const signal_type& sigmask){ return _wait(timeout, &sigmask); }
+			
+			// Every wait records into stats from now on, a null pointer
+			// stops recording. stats must outlive the trigger or be detached.
+			void record(loop_stats *stats) { _stats = stats; }
+			loop_stats *stats() { return _stats; }
+			
+#if defined(__linux__)
+			// Registers the queue's eventfd and runs the queue after every
+			// wait, a null pointer detaches it. The eventfd is reported by
+			// ready() like any other handle, and can be ignored.
+			void attach(task_queue *tasks){
+				if(_tasks) clear(_tasks->native_handle());
+				if((_tasks = tasks)) set(_tasks->native_handle(), POLLIN);
 			}
+			task_queue *tasks() { return _tasks; }
+#endif
 			
-			size_type wait(duration_type timeout = duration_type(0)){ return _poller(timeout); }
+			timers_type& timers() { return _timers; }
 			size_type size() { return _list.size(); }
+			// The interest held for handle, 0 when it is not set.
+			trigger_type interest(native_handle_type handle){
+				if(handle < 0 || static_cast<size_type>(handle) >= _index.size()) return 0;
+				size_type idx = _index[handle];
+				return idx == npos ? 0 : std::get<trigger_type>(_list[idx]);
+			}
 			
 			events_type events() { 
-				events_type events(_poller.size());
-				std::memcpy(events.data(), _poller.events(), _poller.size()*sizeof(event_type));
+				events_type events(_poller().size());
+				std::memcpy(events.data(), _poller().events(), _poller().size()*sizeof(event_type));
 				return events;
 			}
-				
+			
+			// The events reported by the last wait. They are copied out of
+			// the poller before timers and tasks run, so handlers may set(),
+			// clear() and rearm() handles while iterating; an event for a
+			// handle cleared meanwhile is still visited. The view is valid
+			// until the next wait.
+			events_view ready() { return events_view(_ready.data(), _ready.size(), _ready.size()); }
+			
+		protected:
+			basic_trigger_base() = default;
+			~basic_trigger_base() = default;
+			
+		private:
+			// _list is kept dense and _index maps a handle to its position
+			// in _list, so interest changes never search the list.
+			interest_list _list{};
+			index_type _index{};
+			timers_type _timers{};
+			loop_stats *_stats{nullptr};
+#if defined(__linux__)
+			task_queue *_tasks{nullptr};
+#endif
+			// Reused between waits, so the copy does not allocate once it
+			// has grown to the largest number of ready events seen.
+			events_type _ready{};
+			
+			poller_type& _poller() { return static_cast<Derived*>(this)->_backend(); }
+			
+			void _snapshot(size_type nready){
+				_ready.clear();
+				if(nready == npos) return;
+				event_type *events = _poller().events();
+				event_type *completions = _poller().completions();
+				size_type ncompletions = _poller().ncompletions();
+				size_type npolled = nready > ncompletions ? nready - ncompletions : 0;
+				for(size_type i = 0, size = _poller().size(); i < size && _ready.size() < npolled; ++i)
+					if(io::ready(events[i])) _ready.push_back(events[i]);
+				_ready.insert(_ready.end(), completions, completions + ncompletions);
+			}
+			
+			// Keeps the errno of a failed poll for the caller of wait().
+			void _after(){
+				int error = errno;
+				if(_timers.size()) _timers.advance();
+#if defined(__linux__)
+				if(_tasks) _tasks->run();
+#endif
+				errno = error;
+			}
+			size_type _poll(duration_type timeout, const signal_type *sigmask){
+				return sigmask ? _poller()(timeout, *sigmask) : _poller()(timeout);
+			}
+			
+			size_type _wait(duration_type timeout, const signal_type *sigmask){
+				if(_timers.size()){
+					duration_type next = _timers.next();
+					if(timeout.count() < 0 || next < timeout) timeout = next;
+				}
+				if(_stats == nullptr){
+					size_type nready = _poll(timeout, sigmask);
+					_snapshot(nready);
+					_after();
+					return nready;
+				}
+				std::uint64_t start = loop_stats::now();
+				size_type nready = _poll(timeout, sigmask);
+				std::uint64_t end = _stats->ready_at = loop_stats::now();
+				_snapshot(nready);
+				_stats->wait.record(end - start);
+				if(nready != npos) _stats->ready.record(nready);
+				if(nready == 0 && timeout.count() >= 0){
+					std::uint64_t requested = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+					_stats->overrun.record(end - start > requested ? end - start - requested : 0);
+				}
+				_after();
+				return nready;
+			}
+			
+			event_type _event(native_handle_type handle, trigger_type trigger){
+				return static_cast<Derived*>(this)->_mkevent(handle, trigger);
+			}
+	};
+	
+	template<class PollT, class Traits = poll_traits<PollT> >
+	class basic_trigger: public basic_trigger_base<basic_trigger<PollT, Traits>, basic_poller<PollT>, Traits> {
+		public:
+			using Base = basic_trigger_base<basic_trigger<PollT, Traits>, basic_poller<PollT>, Traits>;
+			using poller_type = basic_poller<PollT>;
+			using native_handle_type = typename Base::native_handle_type;
+			using event_type = typename Base::event_type;
+			using trigger_type = typename Base::trigger_type;
+			
+			basic_trigger(poller_type& poller): _poller{poller}{}
+			
 			virtual ~basic_trigger() = default;
 			
 		protected:
 			virtual event_type mkevent(native_handle_type handle, trigger_type trigger){ return {}; }
 			
 		private:
-			interest_list _list{};
+			friend Base;
 			poller_type& _poller;
+			
+			poller_type& _backend() { return _poller; }
+			event_type _mkevent(native_handle_type handle, trigger_type trigger){ return mkevent(handle, trigger); }
 	};
 	
 	class trigger: public basic_trigger<poll_t> {	
@@ -175,6 +1007,7 @@ namespace io {
 			using trigger_type = Base::trigger_type;
 			using event_type = Base::event_type;
 			using events_type = Base::events_type;
+			using events_view = Base::events_view;
 			using event_mask = Base::event_mask;
 			
 			trigger(): Base(_poller){}
@@ -186,6 +1019,118 @@ namespace io {
 		private:
 			poller _poller;
 	};
+	
+#if defined(__linux__)
+	class etrigger: public basic_trigger<epoll_t> {
+		public:
+			using Base = basic_trigger<epoll_t>;
+			using native_handle_type = Base::native_handle_type;
+			using trigger_type = Base::trigger_type;
+			using event_type = Base::event_type;
+			using events_type = Base::events_type;
+			using events_view = Base::events_view;
+			using event_mask = Base::event_mask;
+			
+			etrigger(): Base(_poller){}
+			~etrigger() = default;
+			
+		protected:
+			event_type mkevent(native_handle_type handle, trigger_type trigger) override;
+			
+		private:
+			epoller _poller;
+	};
+	
+	class utrigger: public basic_trigger<uring_t> {
+		public:
+			using Base = basic_trigger<uring_t>;
+			using native_handle_type = Base::native_handle_type;
+			using trigger_type = Base::trigger_type;
+			using event_type = Base::event_type;
+			using events_type = Base::events_type;
+			using events_view = Base::events_view;
+			using event_mask = Base::event_mask;
+			
+			explicit utrigger(bool multishot = false): Base(_poller), _poller(multishot){}
+			// The completion engine for sockbufs in completion mode.
+			upoller& backend() { return _poller; }
+			~utrigger() = default;
+			
+		protected:
+			event_type mkevent(native_handle_type handle, trigger_type trigger) override;
+			
+		private:
+			upoller _poller;
+	};
+#endif
+
+	// basic_trigger without virtual calls: the backend is held by value
+	// and called through static_poller, and events are built inline with
+	// make_event(). BackendT is poller, epoller or upoller, and the
+	// constructor arguments are forwarded to it.
+	template<class BackendT>
+	class basic_static_trigger: public basic_trigger_base<basic_static_trigger<BackendT>, static_poller<BackendT>, poll_traits<typename BackendT::poll_type> > {
+		public:
+			using Base = basic_trigger_base<basic_static_trigger<BackendT>, static_poller<BackendT>, poll_traits<typename BackendT::poll_type> >;
+			using poller_type = static_poller<BackendT>;
+			using native_handle_type = typename Base::native_handle_type;
+			using event_type = typename Base::event_type;
+			using trigger_type = typename Base::trigger_type;
+			
+			template<class... Args>
+			explicit basic_static_trigger(Args&&... args): _poller(std::forward<Args>(args)...){}
+			basic_static_trigger(const basic_static_trigger& other) = delete;
+			basic_static_trigger& operator=(const basic_static_trigger& other) = delete;
+			
+			// For static_utrigger, the completion engine for sockbufs in
+			// completion mode.
+			BackendT& backend() { return _poller; }
+			
+		private:
+			friend Base;
+			poller_type _poller;
+			
+			poller_type& _backend() { return _poller; }
+			event_type _mkevent(native_handle_type handle, trigger_type trigger){ return make_event<event_type>(handle, trigger); }
+	};
+	
+	using static_trigger = basic_static_trigger<poller>;
+#if defined(__linux__)
+	using static_etrigger = basic_static_trigger<epoller>;
+	using static_utrigger = basic_static_trigger<upoller>;
+#endif
+
+#if defined(__linux__)
+	// Signals delivered as readable events on a signalfd(2), so a trigger
+	// can wait for them with everything else instead of through a self
+	// pipe. The signals are blocked in the constructing thread until the
+	// source is destroyed, so create it before starting other threads, or
+	// they can still take the signals the ordinary way. Standard signals
+	// do not queue: one SIGCHLD can stand for several children, so reap
+	// them with waitpid(2) and WNOHANG until it finds none.
+	class signal_source {
+		public:
+			using native_handle_type = int;
+			using signal_type = sigset_t;
+			using info_type = struct signalfd_siginfo;
+			
+			explicit signal_source(std::initializer_list<int> signals);
+			signal_source(const signal_source& other) = delete;
+			signal_source& operator=(const signal_source& other) = delete;
+			
+			native_handle_type native_handle() { return _fd; }
+			const signal_type& mask() { return _mask; }
+			// Takes the next pending signal. Returns 1 when info was filled
+			// in, 0 when no signal is pending and -1 on error.
+			int next(info_type& info);
+			
+			~signal_source();
+			
+		private:
+			signal_type _mask{}, _previous{};
+			native_handle_type _fd{-1};
+	};
+#endif
 
 	template<class TriggerT>
 	class basic_handler {
@@ -193,13 +1138,53 @@ namespace io {
 			using trigger_type = TriggerT;
 			using event_type = typename trigger_type::event_type;
 			using events_type = typename trigger_type::events_type;
+			using events_view = typename trigger_type::events_view;
 			using event_mask = typename trigger_type::event_mask;
 
-			int handle(events_type& events) { return _handle(events); }
+			int handle(events_type& events) { return _dispatched(_handle(events)); }
+			int handle(events_view events) { return _dispatched(_handle(events)); }
+			// Records the time from the last wait of the trigger that shares
+			// stats returning to each handle() call finishing.
+			void record(loop_stats *stats) { _stats = stats; }
 			virtual ~basic_handler() = default;
 
 		protected:
 			virtual int _handle(events_type& events) { return 0; }
+			virtual int _handle(events_view events) { return 0; }
+			
+		private:
+			loop_stats *_stats{nullptr};
+			
+			int _dispatched(int ret){
+				if(_stats) _stats->dispatch.record(loop_stats::now() - _stats->ready_at);
+				return ret;
+			}
+	};
+	
+	// basic_handler without the vtable: handle() calls Derived::_handle()
+	// directly, so it can be inlined into the loop that dispatches events.
+	// Derived only needs to provide the overloads it is called with.
+	template<class Derived, class TriggerT>
+	class basic_static_handler {
+		public:
+			using trigger_type = TriggerT;
+			using event_type = typename trigger_type::event_type;
+			using events_type = typename trigger_type::events_type;
+			using events_view = typename trigger_type::events_view;
+			using event_mask = typename trigger_type::event_mask;
+
+			int handle(events_type& events) { return _dispatched(static_cast<Derived*>(this)->_handle(events)); }
+			int handle(events_view events) { return _dispatched(static_cast<Derived*>(this)->_handle(events)); }
+			// See basic_handler::record().
+			void record(loop_stats *stats) { _stats = stats; }
+			
+		private:
+			loop_stats *_stats{nullptr};
+			
+			int _dispatched(int ret){
+				if(_stats) _stats->dispatch.record(loop_stats::now() - _stats->ready_at);
+				return ret;
+			}
 	};
 }
 #endif
\ No newline at end of file
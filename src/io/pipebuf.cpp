@@ -42,10 +42,16 @@ namespace io{
 		pipebuf::pipebuf(pipebuf&& other):
 			Base(other),
 			_which{std::move(other._which)},
+			_resource{other._resource},
 			_read{std::move(other._read)},
 			_write{std::move(other._write)},
+			_ring{std::move(other._ring)},
 			_pipe{std::move(other._pipe)},
-			BUFSIZE{std::move(other.BUFSIZE)}
+			BUFSIZE{std::move(other.BUFSIZE)},
+			_interest{std::move(other._interest)},
+			_blocked{other._blocked},
+			_nonblocking{other._nonblocking},
+			_stats{std::move(other._stats)}
 		{
 			other._pipe = {};
 		}
@@ -70,10 +76,16 @@ namespace io{
 		
 		pipebuf& pipebuf::operator=(pipebuf&& other){
 			_which = std::move(other._which);
+			_resource = other._resource;
 			_read = std::move(other._read);
 			_write = std::move(other._write);
+			_ring = std::move(other._ring);
 			_pipe = std::move(other._pipe);
 			BUFSIZE = std::move(other.BUFSIZE);
+			_interest = std::move(other._interest);
+			_blocked = other._blocked;
+			_nonblocking = other._nonblocking;
+			_stats = std::move(other._stats);
 			other._pipe = {};
 			Base::operator=(std::move(other));
 			return *this;
@@ -81,14 +93,15 @@ namespace io{
 		
 		void pipebuf::close_read() { 
 			close(_pipe[0]);
-			_read = buffer();
+			_read = buffer(_resource);
+			_ring = ring_buffer();
 			Base::setg(nullptr, nullptr, nullptr);
 			_which &= ~std::ios_base::in;
 		}
 		
 		void pipebuf::close_write() {
 			close(_pipe[1]);
-			_write = buffer();
+			_write = buffer(_resource);
 			Base::setp(nullptr, nullptr);
 			_which &= ~std::ios_base::out;
 		}
@@ -98,6 +111,30 @@ namespace io{
 			return Base::pptr() - Base::pbase();
 		}
 		
+		void pipebuf::nonblocking(bool enable, interest_type interest){
+			_nonblocking = enable;
+			_interest = std::move(interest);
+			if(!_nonblocking) _blocked = 0;
+		}
+		
+		int pipebuf::_wait(short events){
+			if(!_nonblocking){
+				auto start = _stats.now();
+				int ret = _poll(native_handle(), events);
+				_stats.add(io_stats::BLOCKED_NS, _stats.now() - start);
+				return ret;
+			}
+			_want(events, true);
+			return -1;
+		}
+		
+		void pipebuf::_want(short events, bool enable){
+			short blocked = enable ? (_blocked | events) : (_blocked & ~events);
+			if(blocked == _blocked) return;
+			_blocked = blocked;
+			if(_interest) _interest(events & POLLIN ? _pipe[0] : _pipe[1], _blocked & events);
+		}
+		
 		pipebuf::~pipebuf(){
 			for(int fd: _pipe){
 				if(fd > 2) close(fd);
@@ -111,28 +148,36 @@ namespace io{
 				_write.shrink_to_fit();
 				Base::setp(_write.data(), _write.data() + _write.size());
 				Base::pbump(off);
+				_stats.add(io_stats::WBUF_SHRUNK);
 			} else if(Base::pptr() == Base::epptr()) {
 				_write.resize(2*(_write.size()));
 				Base::setp(_write.data(), _write.data() + _write.size());
 				Base::pbump(off);
+				_stats.add(io_stats::WBUF_GROWN);
 			}
 		}
 		
 		int pipebuf::_send(pipebuf::char_type *buf, std::size_t size){
 			int wfd = _pipe[1];
 			std::streamsize len = write(wfd, buf, size);
+			_stats.add(io_stats::WRITE);
 			while(len >= 0){
+				_stats.add(io_stats::BYTES_OUT, len);
 				if(static_cast<std::size_t>(len) < size){
 					size -= len;
 					buf += len;
 					len = write(wfd, buf, size);
+					_stats.add(io_stats::WRITE);
 				} else break;
 			}
 			if(len < 0){
 				switch(errno){
 					case EINTR:
+						_stats.add(io_stats::INTERRUPTED);
 						return _send(buf, size);
 					case EAGAIN:
+						_stats.add(io_stats::WOULDBLOCK);
+						if(buf != Base::pbase()) _stats.add(io_stats::BYTES_MOVED, size);
 						std::memmove(Base::pbase(), buf, size);
 						Base::setp(Base::pbase(), Base::epptr());
 						pbump(size);
@@ -145,7 +190,34 @@ namespace io{
 			return 0;
 		}
 		
+		int pipebuf::ring_mode(bool enable){
+			if(!(_which & std::ios_base::in) || enable == ring_mode()) return 0;
+			std::size_t len = Base::egptr() - Base::gptr();
+			if(enable){
+				try{
+					_ring = ring_buffer(std::max(BUFSIZE, len));
+				} catch(const std::runtime_error& e) {
+					return -1;
+				}
+				std::memcpy(_ring.data(), Base::gptr(), len);
+				Base::setg(_ring.data(), _ring.data(), _ring.data() + len);
+				_read = buffer(_resource);
+			} else {
+				_read.resize(std::max(BUFSIZE, len));
+				std::memcpy(_read.data(), Base::gptr(), len);
+				Base::setg(_read.data(), _read.data(), _read.data() + len);
+				_ring = ring_buffer();
+			}
+			return 0;
+		}
+		
 		void pipebuf::_mvrbuf() {
+			if(ring_mode()){
+				std::size_t size = _ring.size();
+				if(static_cast<std::size_t>(Base::gptr() - Base::eback()) >= size)
+					Base::setg(Base::eback(), Base::gptr() - size, Base::egptr() - size);
+				return;
+			}
 			auto garea = Base::egptr() - Base::gptr();
 			auto oldarea = Base::gptr() - Base::eback();
 			if(garea > 0){
@@ -154,20 +226,26 @@ namespace io{
 				} else {
 					std::memmove(Base::eback(), Base::gptr(), garea);
 				}
+				_stats.add(io_stats::BYTES_MOVED, garea);
 			}
 			Base::setg(Base::eback(), Base::eback(), Base::eback()+garea);
 		}
 		
 		int pipebuf::_recv(){
 			auto rfd = _pipe[0];
-			std::size_t size = Base::eback() + BUFSIZE - Base::egptr();
+			std::size_t size = ring_mode() ? _ring.size() - (Base::egptr() - Base::gptr()) : Base::eback() + BUFSIZE - Base::egptr();
+			if(size == 0) return 0;
 			std::streamsize len = read(rfd, Base::egptr(), size);
+			_stats.add(io_stats::READ);
 			while(len < 0){
 				switch(errno){
 					case EINTR:
+						_stats.add(io_stats::INTERRUPTED);
 						len = read(rfd, Base::egptr(), size);
+						_stats.add(io_stats::READ);
 						break;
 					case EAGAIN:
+						_stats.add(io_stats::WOULDBLOCK);
 						return 0;
 					default:
 						return -1;
@@ -176,10 +254,32 @@ namespace io{
 			if(len == 0){
 				return -1;
 			}
+			_stats.add(io_stats::BYTES_IN, len);
 			Base::setg(Base::eback(), Base::gptr(), Base::egptr()+len);
 			return 0;
 		}
 		
+		int pipebuf::fill(){
+			if(Base::eback() == nullptr) return -1;
+			if(Base::gptr() != Base::eback()) _mvrbuf();
+			std::size_t capacity = ring_mode() ? _ring.size() : BUFSIZE;
+			while(static_cast<std::size_t>(Base::egptr() - Base::gptr()) < capacity){
+				auto *egptr = Base::egptr();
+				if(_recv()) return -1;
+				if(Base::egptr() == egptr) return 1;
+			}
+			return 0;
+		}
+		
+		int pipebuf::drain(){
+			if(Base::pbase() == nullptr) return 0;
+			std::size_t size = Base::pptr() - Base::pbase();
+			if(size > 0 && _send(Base::pbase(), size)) return -1;
+			_resizewbuf();
+			if(_nonblocking) _want(POLLOUT, Base::pptr() != Base::pbase());
+			return Base::pptr() != Base::pbase();
+		}
+		
 		int pipebuf::sync(){
 			if(_which & std::ios_base::out){
 				std::size_t size = Base::pptr()-Base::pbase();
@@ -187,6 +287,7 @@ namespace io{
 					if(_send(Base::pbase(), size)) return -1;
 				}
 				_resizewbuf();
+				if(_nonblocking) _want(POLLOUT, Base::pptr() != Base::pbase());
 			} else if(_which & std::ios_base::in){
 				if(Base::gptr() != Base::eback()) _mvrbuf();
 				if(_recv()) return -1;
@@ -209,9 +310,10 @@ namespace io{
 			if(Base::eback() == nullptr) return traits::eof();
 			if(sync()) return traits::eof();
 			if(Base::gptr() == Base::egptr()) {
-				if(_poll(native_handle(), POLLIN)) return traits::eof();
+				if(_wait(POLLIN)) return traits::eof();
 				return underflow();
 			}
+			if(_nonblocking) _want(POLLIN, false);
 			return traits::to_int_type(*Base::gptr());
 		}	
 		
@@ -219,7 +321,7 @@ namespace io{
 			if(Base::pbase() == nullptr) return traits::eof();
 			if(sync()) return traits::eof();
 			if(Base::pptr() == Base::epptr()){
-				if(_poll(native_handle(), POLLOUT)) return traits::eof();
+				if(_wait(POLLOUT)) return traits::eof();
 				return overflow(ch);
 			}
 			if(traits::eq_int_type(ch, traits::eof())) return traits::eof();
@@ -17,23 +17,32 @@
 #include <poll.h>
 namespace io{
 	poller::size_type poller::_add(native_handle_type handle, events_type& events, event_type event){
-		auto it = std::find_if(events.cbegin(), events.cend(), [&](const auto& ev){ return ev.fd == handle; });
-		if(it != events.cend()) return npos;
+		if(handle < 0) return npos;
+		if(static_cast<size_type>(handle) >= _index.size()) _index.resize(handle+1, npos);
+		size_type& idx = _index[handle];
+		if(idx != npos) return npos;
+		idx = events.size();
 		events.push_back(event);
 		return events.size();
 	}
 	
 	poller::size_type poller::_update(native_handle_type handle, events_type& events, event_type event){
-		auto it = std::find_if(events.begin(), events.end(), [&](auto& ev) { return ev.fd == handle; });
-		if(it == events.end()) return npos;
-		it->events = event.events;
+		if(handle < 0 || static_cast<size_type>(handle) >= _index.size()) return npos;
+		size_type idx = _index[handle];
+		if(idx == npos) return npos;
+		events[idx].events = event.events;
 		return events.size();
 	}
 	
 	poller::size_type poller::_del(native_handle_type handle, events_type& events){
-		auto it = std::find_if(events.cbegin(), events.cend(), [&](const auto& ev){ return ev.fd == handle; });
-		if(it == events.cend()) return npos;
-		events.erase(it);
+		if(handle < 0 || static_cast<size_type>(handle) >= _index.size()) return npos;
+		size_type& idx = _index[handle];
+		if(idx == npos) return npos;
+		auto& back = events.back();
+		_index[back.fd] = idx;
+		events[idx] = back;
+		events.pop_back();
+		idx = npos;
 		return events.size();
 	}
 	
@@ -44,10 +53,19 @@ namespace io{
 		return nfds;
 	}
 	
+	poller::size_type poller::_pwait(duration_type timeout, const signal_type *sigmask){
+		struct timespec ts = {}, *tsp = nullptr;
+		if(timeout.count() >= 0){
+			ts.tv_sec = timeout.count() / 1000;
+			ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+			tsp = &ts;
+		}
+		int nfds = 0;
+		if((nfds = ppoll(Base::events(), Base::size(), tsp, sigmask)) < 0) return npos;
+		return nfds;
+	}
+	
 	trigger::event_type trigger::mkevent(native_handle_type handle, trigger_type trigger){
-		event_type event = {};
-		event.fd = handle;
-		event.events = trigger;
-		return event;
+		return make_event<event_type>(handle, trigger);
 	}
 }
@@ -0,0 +1,202 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "io.hpp"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#pragma once
+#ifndef IO_REACTORS
+#define IO_REACTORS
+namespace io {
+	// Runs one trigger per shard, each on its own thread pinned to a core.
+	// Every shard owns a SO_REUSEPORT listening socket bound to the same
+	// address, so the kernel spreads incoming connections across shards,
+	// and a handler that only ever sees its own shard's events. Work that
+	// would stall a loop can be posted to a shard's queue; when stealing
+	// is enabled, shards with an empty queue take work from the others.
+	// post() and stop() wake the shard through a task_queue attached to
+	// its trigger. A wait interrupted by a signal is retried, any other
+	// failure stops that shard and leaves errno in its error member.
+	template<class TriggerT>
+	class basic_reactor_group {
+		public:
+			using trigger_type = TriggerT;
+			using handler_type = basic_handler<trigger_type>;
+			using duration_type = typename trigger_type::duration_type;
+			using size_type = std::size_t;
+			using sockstream = streams::sockstream;
+			using task_type = std::function<void()>;
+			using factory_type = std::function<std::unique_ptr<handler_type>(size_type, trigger_type&, sockstream&)>;
+			static constexpr int DEFAULT_BACKLOG = SOMAXCONN;
+			
+			class work_queue {
+				public:
+					void push(task_type task){
+						std::lock_guard<std::mutex> lock(_mtx);
+						_tasks.push_back(std::move(task));
+					}
+					
+					bool pop(task_type& task){
+						std::lock_guard<std::mutex> lock(_mtx);
+						if(_tasks.empty()) return false;
+						task = std::move(_tasks.back());
+						_tasks.pop_back();
+						return true;
+					}
+					
+					bool steal(task_type& task){
+						std::unique_lock<std::mutex> lock(_mtx, std::try_to_lock);
+						if(!lock.owns_lock() || _tasks.empty()) return false;
+						task = std::move(_tasks.front());
+						_tasks.pop_front();
+						return true;
+					}
+					
+				private:
+					std::mutex _mtx;
+					std::deque<task_type> _tasks;
+			};
+			
+			struct shard_type {
+				trigger_type trigger;
+				sockstream listener;
+				std::unique_ptr<handler_type> handler;
+				work_queue tasks;
+				task_queue wakeup;
+				std::thread thread;
+				int error{0};
+				
+				shard_type(int domain, int type, int protocol):
+					trigger{},
+					listener(domain, type, protocol, {}, std::ios_base::in | std::ios_base::out, true)
+				{
+					trigger.attach(&wakeup);
+				}
+			};
+			
+			basic_reactor_group(size_type nshards, const struct sockaddr *addr, factory_type factory, bool steal = false, int backlog = DEFAULT_BACKLOG, duration_type interval = duration_type(100)):
+				_factory{std::move(factory)},
+				_interval{interval},
+				_steal{steal}
+			{
+				if(nshards == 0) throw std::invalid_argument("A reactor group needs at least one shard.");
+				for(size_type i = 0; i < nshards; ++i){
+					_shards.push_back(std::make_unique<shard_type>(addr->sa_family, SOCK_STREAM, 0));
+					auto& shard = *_shards.back();
+					int sockfd = shard.listener.native_handle();
+					if(shard.listener.setopt(streams::sockopts::reuseport{1})) throw std::runtime_error("Unable to set SO_REUSEPORT.");
+					fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+					buffers::optval addr_(sizeof(addr));
+					std::memcpy(addr_.data(), &addr, sizeof(addr));
+					shard.listener.setopt({"BIND", addr_});
+					buffers::optval backlog_(sizeof(int));
+					std::memcpy(backlog_.data(), &backlog, sizeof(int));
+					shard.listener.setopt({"LISTEN", backlog_});
+					shard.handler = _factory(i, shard.trigger, shard.listener);
+				}
+			}
+			
+			basic_reactor_group(const basic_reactor_group& other) = delete;
+			basic_reactor_group& operator=(const basic_reactor_group& other) = delete;
+			
+			void start(){
+				if(_running.exchange(true)) return;
+				for(size_type i = 0; i < _shards.size(); ++i)
+					_shards[i]->thread = std::thread(&basic_reactor_group::_run, this, i);
+			}
+			
+			void stop(){
+				if(!_running.exchange(false)) return;
+				for(auto& shard: _shards) shard->wakeup.post({});
+				for(auto& shard: _shards)
+					if(shard->thread.joinable()) shard->thread.join();
+			}
+			
+			void post(size_type shard, task_type task){
+				auto& shard_ = *_shards.at(shard);
+				shard_.tasks.push(std::move(task));
+				shard_.wakeup.post({});
+			}
+			shard_type& operator[](size_type shard){ return *_shards[shard]; }
+			size_type size() { return _shards.size(); }
+			
+			~basic_reactor_group(){ stop(); }
+			
+		private:
+			std::vector<std::unique_ptr<shard_type> > _shards{};
+			factory_type _factory;
+			duration_type _interval;
+			std::atomic<bool> _running{false};
+			bool _steal;
+			
+			// Pins the shard to one of the CPUs the process may run on, so
+			// a restricted cpuset is respected.
+			static void _pin(size_type shard){
+				cpu_set_t allowed, cpus;
+				CPU_ZERO(&allowed);
+				if(sched_getaffinity(0, sizeof(allowed), &allowed)) return;
+				int ncpus = CPU_COUNT(&allowed);
+				if(ncpus <= 0) return;
+				int nth = static_cast<int>(shard % ncpus);
+				for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu){
+					if(!CPU_ISSET(cpu, &allowed) || nth-- > 0) continue;
+					CPU_ZERO(&cpus);
+					CPU_SET(cpu, &cpus);
+					pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+					return;
+				}
+			}
+			
+			bool _next(size_type shard, task_type& task){
+				if(_shards[shard]->tasks.pop(task)) return true;
+				if(!_steal) return false;
+				for(size_type i = 1; i < _shards.size(); ++i)
+					if(_shards[(shard + i) % _shards.size()]->tasks.steal(task)) return true;
+				return false;
+			}
+			
+			void _run(size_type i){
+				auto& shard = *_shards[i];
+				_pin(i);
+				shard.trigger.set(shard.listener.native_handle(), POLLIN);
+				task_type task;
+				while(_running.load(std::memory_order_relaxed)){
+					if(shard.trigger.wait(_interval) == trigger_type::npos){
+						if(errno == EINTR) continue;
+						shard.error = errno;
+						break;
+					}
+					shard.handler->handle(shard.trigger.ready());
+					while(_next(i, task)) task();
+				}
+			}
+	};
+	
+	using reactor_group = basic_reactor_group<trigger>;
+}
+#endif
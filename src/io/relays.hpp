@@ -0,0 +1,174 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "io.hpp"
+#include <array>
+#include <memory>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+
+#pragma once
+#ifndef IO_RELAYS
+#define IO_RELAYS
+namespace io {
+	// Forwards everything read from source to sink, and optionally to a
+	// mirror, without the bytes ever entering user space. Data is spliced
+	// from source into a pipe and from the pipe into sink; the mirror gets
+	// a tee of the pipe through a second pipe. The relay only reads while
+	// the pipe has room and only waits for POLLOUT while it holds data, so
+	// a slow sink or mirror pushes back on source. pump() should be called
+	// whenever the trigger reports any of the relay's handles as ready.
+	// Bytes already buffered in the streams are forwarded first. splice()
+	// only treats the pipe end as non-blocking, so source, sink and mirror
+	// are switched to O_NONBLOCK. A relay moves data in one direction, a
+	// proxy uses one relay per direction.
+	template<class TriggerT>
+	class basic_relay {
+		public:
+			using trigger_type = TriggerT;
+			using mask_type = typename trigger_type::trigger_type;
+			using sockbuf = buffers::sockbuf;
+			using pipebuf = buffers::pipebuf;
+			using size_type = std::size_t;
+			
+			basic_relay(trigger_type& trigger, sockbuf& source, sockbuf& sink, sockbuf *mirror = nullptr):
+				_trigger{trigger},
+				_source{source},
+				_sink{sink},
+				_mirror{mirror},
+				_pipe{std::make_unique<pipebuf>(std::ios_base::openmode())}
+			{
+				if(_mirror) _tee = std::make_unique<pipebuf>(std::ios_base::openmode());
+				int capacity = fcntl(_pipe->native_handle()[1], F_GETPIPE_SZ);
+				_capacity = capacity > 0 ? capacity : 65536;
+				
+				_nonblock(_source.native_handle());
+				_nonblock(_sink.native_handle());
+				if(_mirror) _nonblock(_mirror->native_handle());
+				
+				std::array<char, 4096> buf;
+				size_type avail = 0;
+				while((avail = _source.buffered()) > 0){
+					std::streamsize len = _source.sgetn(buf.data(), std::min<size_type>(avail, buf.size()));
+					_sink.sputn(buf.data(), len);
+					if(_mirror) _mirror->sputn(buf.data(), len);
+				}
+			}
+			
+			basic_relay(const basic_relay& other) = delete;
+			basic_relay& operator=(const basic_relay& other) = delete;
+			
+			// Returns 1 once source has reached end of file and everything
+			// has been forwarded, 0 while the relay is still running and
+			// -1 on error.
+			int pump(){
+				if(_sink.pending() && _sink.pubsync()) return -1;
+				if(_mirror && _mirror->pending() && _mirror->pubsync()) return -1;
+				if(_sink.pending() || (_mirror && _mirror->pending())){
+					_watch(0, _source.native_handle(), POLLIN, false);
+					_watch(1, _sink.native_handle(), POLLOUT, _sink.pending());
+					if(_mirror) _watch(2, _mirror->native_handle(), POLLOUT, _mirror->pending());
+					return 0;
+				}
+				
+				// Repeats until nothing moves: a partial tee() leaves bytes
+				// in the pipe that no handle will report as ready once the
+				// sink has taken the teed part.
+				int *pipe = _pipe->native_handle();
+				for(bool progress = true; progress;){
+					progress = false;
+					if(!_eof && _queued < _capacity){
+						ssize_t len = splice(_source.native_handle(), nullptr, pipe[1], nullptr, _capacity - _queued, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+						if(len > 0){
+							_queued += len;
+							progress = true;
+						} else if(len == 0) _eof = true;
+						else if(errno != EAGAIN && errno != EINTR) return -1;
+					}
+					if(_mirror){
+						int *tee_ = _tee->native_handle();
+						if(_teed == 0 && _queued > 0){
+							ssize_t len = tee(pipe[0], tee_[1], _queued, SPLICE_F_NONBLOCK);
+							if(len > 0){
+								_teed = len;
+								_mirrored += len;
+								progress = true;
+							} else if(len < 0 && errno != EAGAIN && errno != EINTR) return -1;
+						}
+						if(_mirrored > 0){
+							ssize_t len = splice(tee_[0], nullptr, _mirror->native_handle(), nullptr, _mirrored, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+							if(len > 0){
+								_mirrored -= len;
+								progress = true;
+							} else if(len < 0 && errno != EAGAIN && errno != EINTR) return -1;
+						}
+					}
+					size_type limit = _mirror ? _teed : _queued;
+					if(limit > 0){
+						ssize_t len = splice(pipe[0], nullptr, _sink.native_handle(), nullptr, limit, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+						if(len > 0){
+							_queued -= len;
+							if(_mirror) _teed -= len;
+							progress = true;
+						} else if(len < 0 && errno != EAGAIN && errno != EINTR) return -1;
+					}
+				}
+				
+				_watch(0, _source.native_handle(), POLLIN, !_eof && _queued < _capacity);
+				_watch(1, _sink.native_handle(), POLLOUT, (_mirror ? _teed : _queued) > 0);
+				if(_mirror) _watch(2, _mirror->native_handle(), POLLOUT, _mirrored > 0);
+				return done();
+			}
+			
+			bool done() { return _eof && _queued == 0 && _mirrored == 0; }
+			size_type queued() { return _queued; }
+			
+			~basic_relay(){
+				_watch(0, _source.native_handle(), POLLIN, false);
+				_watch(1, _sink.native_handle(), POLLOUT, false);
+				if(_mirror) _watch(2, _mirror->native_handle(), POLLOUT, false);
+			}
+			
+		private:
+			trigger_type& _trigger;
+			sockbuf &_source, &_sink;
+			sockbuf *_mirror;
+			std::unique_ptr<pipebuf> _pipe, _tee;
+			// The interest the relay added to each handle, and the only
+			// interest it clears again.
+			std::array<mask_type, 3> _watching{};
+			size_type _capacity{0}, _queued{0}, _teed{0}, _mirrored{0};
+			bool _eof{false};
+			
+			static void _nonblock(int handle){
+				int flags = fcntl(handle, F_GETFL);
+				if(flags >= 0 && !(flags & O_NONBLOCK)) fcntl(handle, F_SETFL, flags | O_NONBLOCK);
+			}
+			
+			void _watch(std::size_t i, int handle, mask_type mask, bool on){
+				if(on){
+					if(_watching[i]) return;
+					if((_watching[i] = mask & ~_trigger.interest(handle))) _trigger.set(handle, _watching[i]);
+				} else if(_watching[i]){
+					_trigger.clear(handle, _watching[i]);
+					_watching[i] = 0;
+				}
+			}
+	};
+	
+	using relay = basic_relay<trigger>;
+}
+#endif
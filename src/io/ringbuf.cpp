@@ -0,0 +1,70 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "buffers.hpp"
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+namespace io{
+    namespace buffers{
+        ring_buffer::ring_buffer(std::size_t size){
+            std::size_t page = sysconf(_SC_PAGESIZE);
+            _size = (size + page - 1) / page * page;
+            int fd = memfd_create("cpp-aio-ring", MFD_CLOEXEC);
+            if(fd < 0) throw std::runtime_error("Unable to create ring buffer memory.");
+            if(ftruncate(fd, _size)){
+                close(fd);
+                throw std::runtime_error("Unable to size ring buffer memory.");
+            }
+            void *addr = mmap(nullptr, 2*_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(addr == MAP_FAILED){
+                close(fd);
+                throw std::runtime_error("Unable to reserve ring buffer mapping.");
+            }
+            char *base = static_cast<char*>(addr);
+            if(mmap(base, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+                || mmap(base + _size, _size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+            {
+                munmap(addr, 2*_size);
+                close(fd);
+                throw std::runtime_error("Unable to map ring buffer.");
+            }
+            close(fd);
+            _data = base;
+        }
+
+        ring_buffer::ring_buffer(ring_buffer&& other):
+            _data{other._data},
+            _size{other._size}
+        {
+            other._data = nullptr;
+            other._size = 0;
+        }
+
+        ring_buffer& ring_buffer::operator=(ring_buffer&& other){
+            if(this == &other) return *this;
+            if(_data) munmap(_data, 2*_size);
+            _data = other._data;
+            _size = other._size;
+            other._data = nullptr;
+            other._size = 0;
+            return *this;
+        }
+
+        ring_buffer::~ring_buffer(){
+            if(_data) munmap(_data, 2*_size);
+        }
+    }
+}
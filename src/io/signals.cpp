@@ -0,0 +1,54 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "io.hpp"
+#if defined(__linux__)
+#include <stdexcept>
+#include <cerrno>
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+namespace io{
+	signal_source::signal_source(std::initializer_list<int> signals){
+		sigemptyset(&_mask);
+		for(int signo: signals) sigaddset(&_mask, signo);
+		if(pthread_sigmask(SIG_BLOCK, &_mask, &_previous)) throw std::runtime_error("Unable to block signals.");
+		if((_fd = signalfd(-1, &_mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0){
+			pthread_sigmask(SIG_SETMASK, &_previous, nullptr);
+			throw std::runtime_error("Unable to create signalfd.");
+		}
+	}
+	
+	int signal_source::next(info_type& info){
+		ssize_t len = 0;
+		while((len = read(_fd, &info, sizeof(info))) < 0){
+			switch(errno){
+				case EINTR:
+					continue;
+				case EAGAIN:
+					return 0;
+				default:
+					return -1;
+			}
+		}
+		return len == sizeof(info) ? 1 : -1;
+	}
+	
+	signal_source::~signal_source(){
+		if(_fd > 2) close(_fd);
+		pthread_sigmask(SIG_SETMASK, &_previous, nullptr);
+	}
+}
+#endif
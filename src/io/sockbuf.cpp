@@ -20,8 +20,12 @@
 #include <cctype>
 #include <cstring>
 #include <cstdint>
+#include <climits>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <unistd.h>
@@ -31,6 +35,8 @@ namespace io{
         using sockaddr_t = struct sockaddr;
         using sockaddr_storage = struct sockaddr_storage;   
         
+        // Returns 1 when the socket reports POLLERR, which the caller has to
+        // look into: the error queue may only hold notifications.
         static int _poll(int socket, short events){
             struct pollfd fds[1] = {};
             fds[0] = {
@@ -44,8 +50,11 @@ namespace io{
                     default:
                         return -1;
                 }
-            } else if(fds[0].revents & (POLLHUP | POLLERR))
+            } else if(fds[0].revents & POLLHUP) {
                 return -1;
+            } else if(fds[0].revents & POLLERR) {
+                return 1;
+            }
             return 0;
         }
         
@@ -79,6 +88,12 @@ namespace io{
                 case AF_UNIX:
                     size = sizeof(struct sockaddr_un);
                     break;
+                case AF_INET:
+                    size = sizeof(struct sockaddr_in);
+                    break;
+                case AF_INET6:
+                    size = sizeof(struct sockaddr_in6);
+                    break;
                 default:    
                     throw std::runtime_error("Unknown socket domain.");
             }
@@ -92,29 +107,151 @@ namespace io{
             if(listen(socket, *backlog)) throw std::runtime_error("Unable to listen on socket.");
         }
         
-        static std::size_t getbuflen(std::vector<std::vector<char> >& buffers, const char* base){
+        static std::size_t getbuflen(std::vector<sockbuf::buffer>& buffers, const char* base){
             auto it = std::find_if(buffers.cbegin(), buffers.cend(), [&](const auto& buf){ return buf.data() == base; });
             if(it == buffers.cend()) return SIZE_MAX;
             return it->size();
         }
         
         void sockbuf::_init_buf_ptrs(){
+            if(_lazy){
+                if(_which & std::ios_base::in) _buffers.emplace_back(_resource);
+                if(_which & std::ios_base::out) _buffers.emplace_back(_resource);
+                return;
+            }
             if(_which & std::ios_base::in){
-                _buffers.emplace_back();
+                _buffers.emplace_back(_resource);
                 auto& buf = _buffers.back();
                 buf.resize(BUFSIZE);
                 Base::setg(buf.data(), buf.data(), buf.data()); 
             }
             if(_which & std::ios_base::out){
-                _buffers.emplace_back();
+                _buffers.emplace_back(_resource);
                 auto& buf = _buffers.back();
                 buf.resize(BUFSIZE);
                 Base::setp(buf.data(), buf.data() + buf.size()); 
+                _pmark = Base::pbase();
+            }
+        }
+        
+        int sockbuf::_reserve(std::ios_base::openmode which){
+            if(!_lazy || !(_which & which) || _buffers.empty()) return -1;
+            if(which & std::ios_base::in){
+                auto& buf = _buffers.front();
+                buf.resize(BUFSIZE);
+                Base::setg(buf.data(), buf.data(), buf.data());
+            } else {
+                auto& buf = _buffers.back();
+                buf.resize(BUFSIZE);
+                Base::setp(buf.data(), buf.data() + buf.size());
+                _pmark = Base::pbase();
             }
+            return 0;
+        }
+
+        void sockbuf::_trim(std::ios_base::openmode which){
+            if((which & _which & std::ios_base::in) && !ring_mode() && !_receiving()
+                && Base::eback() != nullptr && Base::gptr() == Base::egptr())
+            {
+                _buffers.front() = buffer(_resource);
+                Base::setg(nullptr, nullptr, nullptr);
+            }
+            if((which & _which & std::ios_base::out) && Base::pbase() != nullptr && !_sending()
+                && Base::pptr() == Base::pbase() && _wbytes == 0 && !zerocopy_pending())
+            {
+                _buffers.back() = buffer(_resource);
+                _spare = buffer(_resource);
+                if(_wqueue.empty()){
+                    _wqueue.release();
+                    _retired.release();
+                }
+                _zcbufs.release();
+                Base::setp(nullptr, nullptr);
+                _pmark = nullptr;
+                _stats.add(io_stats::WBUF_SHRUNK);
+            }
+        }
+
+        void sockbuf::lazy(bool enable){
+            if(enable){
+                _lazy = true;
+                _trim(std::ios_base::in | std::ios_base::out);
+                return;
+            }
+            if(Base::eback() == nullptr) _reserve(std::ios_base::in);
+            if(Base::pbase() == nullptr) _reserve(std::ios_base::out);
+            _lazy = false;
         }
         
-        int sockbuf::_send(char_type *buf, size_type size){
-            iovec& iov = _iov[1];
+        void sockbuf::nonblocking(bool enable, interest_type interest){
+            _nonblocking = enable;
+            _interest = std::move(interest);
+            if(_nonblocking){
+                int flags = fcntl(_socket, F_GETFL);
+                if(!(flags & O_NONBLOCK)) fcntl(_socket, F_SETFL, flags | O_NONBLOCK);
+            } else {
+                _blocked = 0;
+            }
+        }
+
+        int sockbuf::_wait(short events){
+            if(!_nonblocking){
+                auto start = _stats.now();
+                int ret = _poll(_socket, events);
+                _stats.add(io_stats::BLOCKED_NS, _stats.now() - start);
+                if(ret <= 0) return ret;
+                // POLLERR with nothing queued is the socket's own error.
+                if(_reap() > 0) return 0;
+                int error = 0;
+                socklen_t len = sizeof(error);
+                if(getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &len) < 0) error = errno;
+                if(error == 0) return 0;
+                _errno = error;
+                return -1;
+            }
+            _want(events, true);
+            _errno = EWOULDBLOCK;
+            return -1;
+        }
+
+        void sockbuf::_want(short events, bool enable){
+            short blocked = enable ? (_blocked | events) : (_blocked & ~events);
+            if(blocked == _blocked) return;
+            _blocked = blocked;
+            if(_interest) _interest(_socket, _blocked);
+        }
+        
+        void sockbuf::_seal(){
+            auto size = Base::pptr() - _pmark;
+            if(size <= 0) return;
+            _wqueue.push_back({{_pmark, static_cast<size_type>(size)}, false, {-1, 0}});
+            _wbytes += size;
+            _pmark = Base::pptr();
+        }
+
+        void sockbuf::_advance(size_type len){
+            _wbytes -= len;
+            while(!_wqueue.empty()){
+                auto& iov = std::get<iovec>(_wqueue.front());
+                if(iov.iov_len > len){
+                    auto& file = std::get<file_range>(_wqueue.front());
+                    if(std::get<native_handle_type>(file) < 0)
+                        iov.iov_base = static_cast<char_type*>(iov.iov_base) + len;
+                    else std::get<off_t>(file) += len;
+                    iov.iov_len -= len;
+                    return;
+                }
+                len -= iov.iov_len;
+                if(std::get<bool>(_wqueue.front())){
+                    _release(std::move(_retired.front()));
+                    _retired.pop_front();
+                }
+                _wqueue.pop_front();
+            }
+        }
+
+        int sockbuf::_send(){
+            if(_engine) return _submit_send();
             struct msghdr *msgptr = &_msghdrs[1];
             auto& address = std::get<sockaddr_storage>(_addresses[1]);
             if(!_connected && address.ss_family != AF_UNSPEC){
@@ -125,64 +262,180 @@ namespace io{
                 msgptr->msg_name = nullptr;
                 msgptr->msg_namelen = 0;
             }
-            if(size > 0){
-                iov.iov_base = buf;
-                iov.iov_len = size;
-                msgptr->msg_iov = &iov;
-                msgptr->msg_iovlen = 1;
-            } else {
-                iov.iov_base = nullptr;
-                iov.iov_len = 0;
-                msgptr->msg_iov = nullptr;
-                msgptr->msg_iovlen = 0;
-            }
-            
-            std::streamsize len = sendmsg(_socket, msgptr, MSG_DONTWAIT | MSG_NOSIGNAL);
-            while(len >= 0){
+            int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+            if(_zcthreshold && _wbytes >= _zcthreshold) flags |= MSG_ZEROCOPY;
+            std::streamsize len = 0;
+            // sendfile(2) has no MSG_DONTWAIT, so the socket is only
+            // O_NONBLOCK while file ranges are being sent.
+            int fileflags = -1;
+            do {
+                while(!_wqueue.empty() && std::get<iovec>(_wqueue.front()).iov_len == 0) _advance(0);
+                if(!_wqueue.empty() && std::get<native_handle_type>(std::get<file_range>(_wqueue.front())) >= 0){
+                    if(fileflags < 0 && (fileflags = fcntl(_socket, F_GETFL)) >= 0 && !(fileflags & O_NONBLOCK))
+                        fcntl(_socket, F_SETFL, fileflags | O_NONBLOCK);
+                    if((len = _sendfile()) < 0) break;
+                    continue;
+                }
+                _wiov.clear();
+                for(auto& seg: _wqueue){
+                    if(_wiov.size() == IOV_MAX || std::get<native_handle_type>(std::get<file_range>(seg)) >= 0) break;
+                    auto& iov = std::get<iovec>(seg);
+                    if(iov.iov_len > 0) _wiov.push_back(iov);
+                }
+                msgptr->msg_iov = _wiov.empty() ? nullptr : _wiov.data();
+                msgptr->msg_iovlen = _wiov.size();
+                len = sendmsg(_socket, msgptr, flags);
+                _stats.add(io_stats::SENDMSG);
+                if(len < 0){
+                    if(errno != ENOBUFS || !(flags & MSG_ZEROCOPY)) break;
+                    flags &= ~MSG_ZEROCOPY;
+                    len = 0;
+                    continue;
+                }
+                if(len > 0 && (flags & MSG_ZEROCOPY)) ++_zcnext;
                 if(msgptr->msg_control != nullptr){
                     msgptr->msg_control = nullptr;
                     msgptr->msg_controllen = 0;
                 }
-                if(static_cast<std::size_t>(len) == size) {
-                    Base::setp(Base::pbase(), Base::epptr());
-                    return 0;
-                }
-                buf += len;
-                size -= len;
-                iov.iov_base = buf;
-                iov.iov_len = size;
-                len = sendmsg(_socket, msgptr, MSG_DONTWAIT | MSG_NOSIGNAL);
+                _stats.add(io_stats::BYTES_OUT, len);
+                _advance(len);
+            } while(_wbytes > 0);
+            if(fileflags >= 0 && !(fileflags & O_NONBLOCK)){
+                int error = errno;
+                fcntl(_socket, F_SETFL, fileflags);
+                errno = error;
             }
             if(len < 0){
                 switch(errno){
                     case EISCONN:
                         _connected = true;
+                        return _send();
                     case EINTR:
-                        return _send(buf, size);
+                        _stats.add(io_stats::INTERRUPTED);
+                        return _send();
                     case EWOULDBLOCK:
-                        std::memmove(Base::pbase(), buf, size);
-                        Base::setp(Base::pbase(), Base::epptr());
-                        Base::pbump(size);
+                        _stats.add(io_stats::WOULDBLOCK);
                         return 0;
                     default:
-                        std::memmove(Base::pbase(), buf, size);
-                        Base::setp(Base::pbase(), Base::epptr());
-                        Base::pbump(size);
                         _errno = errno;
                         return -1;
                 }
             }
-            Base::setp(Base::pbase(), Base::epptr());
+            _wqueue.clear();
+            if(zerocopy_pending()){
+                _release(_swapwbuf());
+            } else {
+                Base::setp(Base::pbase(), Base::epptr());
+                _pmark = Base::pbase();
+            }
+            return 0;
+        }
+
+        std::streamsize sockbuf::_sendfile(){
+            auto& iov = std::get<iovec>(_wqueue.front());
+            auto& file = std::get<file_range>(_wqueue.front());
+            auto fd = std::get<native_handle_type>(file);
+            off_t offset = std::get<off_t>(file);
+            std::streamsize len = ::sendfile(_socket, fd, &offset, iov.iov_len);
+            _stats.add(io_stats::SENDFILE);
+            if(len < 0 && (errno == EINVAL || errno == ESPIPE)){
+                len = splice(fd, nullptr, _socket, nullptr, iov.iov_len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                _stats.add(io_stats::SENDFILE);
+            }
+            if(len < 0) return -1;
+            if(len == 0){
+                // The file ended before the queued range did.
+                _wbytes -= iov.iov_len;
+                _wqueue.pop_front();
+                return 0;
+            }
+            _stats.add(io_stats::BYTES_OUT, len);
+            _advance(len);
+            return len;
+        }
+
+        sockbuf::size_type sockbuf::appendfile(native_handle_type fd, off_t offset, size_type count){
+            if(_engine) return 0;
+            if(Base::pbase() == nullptr && _reserve(std::ios_base::out)) return 0;
+            _seal();
+            _wqueue.push_back({{nullptr, count}, false, {fd, offset}});
+            _wbytes += count;
+            return _wbytes;
+        }
+
+        sockbuf::buffer sockbuf::_swapwbuf(){
+            auto it = std::find_if(_buffers.begin(), _buffers.end(), [&](auto& buf){ return buf.data() == Base::pbase(); });
+            if(it == _buffers.end()) throw std::runtime_error("Write buffer could not be found.");
+            buffer old = std::move(*it);
+            *it = std::move(_spare);
+            _spare = buffer(_resource);
+            it->resize(BUFSIZE);
+            Base::setp(it->data(), it->data() + it->size());
+            _pmark = Base::pbase();
+            return old;
+        }
+
+        // Buffers that may still be referenced by zerocopy sends are held
+        // until the kernel reports the last send issued before their release.
+        void sockbuf::_release(buffer&& buf){
+            if(zerocopy_pending()) _zcbufs.push_back({_zcnext - 1, std::move(buf)});
+            else if(_spare.empty()) _spare = std::move(buf);
+        }
+
+        // Drains the error queue and returns the number of entries read.
+        // Zerocopy completions release parked buffers. Everything else,
+        // such as timestamps, ICMP reports and completions older than one
+        // already seen, is dropped, since leaving it queued keeps POLLERR
+        // raised.
+        sockbuf::size_type sockbuf::_reap(){
+            char control[128];
+            struct msghdr msg = {};
+            size_type count = 0;
+            for(;; ++count){
+                msg.msg_control = control;
+                msg.msg_controllen = sizeof(control);
+                _stats.add(io_stats::RECVMSG);
+                if(recvmsg(_socket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+                for(auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)){
+                    if(!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                        || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) continue;
+                    struct sock_extended_err err = {};
+                    std::memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                    if(err.ee_errno == 0 && err.ee_origin == SO_EE_ORIGIN_ZEROCOPY
+                        && static_cast<std::int32_t>(err.ee_data + 1 - _zcdone) > 0)
+                        _zcdone = err.ee_data + 1;
+                }
+            }
+            while(!_zcbufs.empty() && static_cast<std::int32_t>(std::get<std::uint32_t>(_zcbufs.front()) - _zcdone) < 0){
+                if(_spare.empty()) _spare = std::move(std::get<buffer>(_zcbufs.front()));
+                _zcbufs.pop_front();
+            }
+            return count;
+        }
+
+        int sockbuf::zerocopy(size_type threshold){
+            int on = threshold > 0;
+            if(on && setsockopt(_socket, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on))){
+                _errno = errno;
+                return -1;
+            }
+            _zcthreshold = threshold;
             return 0;
         }
 
         int sockbuf::_recv(){
+            if(_engine) return _submit_recv();
             iovec& iov = _iov[0];
             struct msghdr *msgptr = &_msghdrs[0];
-            size_type buflen = getbuflen(_buffers, Base::eback());
-            if(buflen == SIZE_MAX) return -1;
             iov.iov_base = Base::egptr();
-            iov.iov_len = Base::eback() + buflen - Base::egptr();
+            if(ring_mode()){
+                iov.iov_len = _ring.size() - (Base::egptr() - Base::gptr());
+                if(iov.iov_len == 0) return 0;
+            } else {
+                size_type buflen = getbuflen(_buffers, Base::eback());
+                if(buflen == SIZE_MAX) return -1;
+                iov.iov_len = Base::eback() + buflen - Base::egptr();
+            }
             
             msgptr->msg_name = &(std::get<sockaddr_storage>(_addresses[0]));
             msgptr->msg_namelen = sizeof(sockaddr_storage);
@@ -196,12 +449,16 @@ namespace io{
                 msgptr->msg_controllen = 0;
             }
             std::streamsize len = recvmsg(_socket, msgptr, MSG_DONTWAIT);
+            _stats.add(io_stats::RECVMSG);
             while(len < 0){
                 switch(errno){
                     case EINTR:
+                        _stats.add(io_stats::INTERRUPTED);
                         len = recvmsg(_socket, msgptr, MSG_DONTWAIT);
+                        _stats.add(io_stats::RECVMSG);
                         break;
                     case EWOULDBLOCK:
+                        _stats.add(io_stats::WOULDBLOCK);
                         return 0;
                     default:
                         _errno = errno;
@@ -209,11 +466,213 @@ namespace io{
                 }
             }
             if(len == 0) return -1;
+            _stats.add(io_stats::BYTES_IN, len);
             Base::setg(Base::eback(), Base::gptr(), Base::egptr()+len);
             return 0;
         }
         
+        int sockbuf::fill(){
+            if(Base::eback() == nullptr && _reserve(std::ios_base::in)) return -1;
+            if(Base::gptr() != Base::eback() && !_receiving()) _memmoverbuf();
+            size_type capacity = ring_mode() ? _ring.size() : getbuflen(_buffers, Base::eback());
+            if(capacity == SIZE_MAX) return -1;
+            while(static_cast<size_type>(Base::egptr() - Base::gptr()) < capacity){
+                auto *egptr = Base::egptr();
+                if(_recv()) return -1;
+                if(Base::egptr() == egptr) return 1;
+            }
+            return 0;
+        }
+
+        int sockbuf::drain(){
+            if(!(_which & std::ios_base::out)) return 0;
+            if(sync()) return -1;
+            return _wbytes > 0;
+        }
+        
+        int sockbuf::completion(completion_engine *engine){
+            if(engine == _engine) return 0;
+            if(_wbytes > 0 || _sending() || _receiving()){
+                _errno = EBUSY;
+                return -1;
+            }
+            if((_engine = engine)){
+                if(!_cstate) _cstate = std::make_shared<completion_state>();
+                _cstate->owner = this;
+                _nonblocking = true;
+            }
+            return 0;
+        }
+        
+        // The completions hold the state rather than the sockbuf, and only
+        // reach the sockbuf through its owner.
+        int sockbuf::_submit_send(){
+            auto& state = *_cstate;
+            if(state.send) return 0;
+            while(!_wqueue.empty() && std::get<iovec>(_wqueue.front()).iov_len == 0) _advance(0);
+            state.siov.clear();
+            for(auto& seg: _wqueue){
+                if(state.siov.size() == IOV_MAX) break;
+                auto& iov = std::get<iovec>(seg);
+                if(iov.iov_len > 0) state.siov.push_back(iov);
+            }
+            if(state.siov.empty()) return 0;
+            auto& msg = state.smsg;
+            msg = {};
+            auto& address = std::get<sockaddr_storage>(_addresses[1]);
+            if(!_connected && address.ss_family != AF_UNSPEC){
+                state.saddr = address;
+                msg.msg_name = &state.saddr;
+                msg.msg_namelen = std::get<socklen_t>(_addresses[1]);
+            }
+            msg.msg_iov = state.siov.data();
+            msg.msg_iovlen = state.siov.size();
+            auto& user = _msghdrs[1];
+            if(user.msg_control != nullptr){
+                auto *control = static_cast<char*>(user.msg_control);
+                state.scontrol.assign(control, control + user.msg_controllen);
+                msg.msg_control = state.scontrol.data();
+                msg.msg_controllen = state.scontrol.size();
+                user.msg_control = nullptr;
+                user.msg_controllen = 0;
+            }
+            state.send = _engine->sendmsg(_socket, &msg, MSG_NOSIGNAL, [cstate = _cstate](int res) -> short {
+                cstate->send = 0;
+                return cstate->owner ? cstate->owner->_sent(res) : 0;
+            });
+            _stats.add(io_stats::SENDMSG);
+            if(state.send) return 0;
+            _errno = EAGAIN;
+            return -1;
+        }
+        
+        int sockbuf::_submit_recv(){
+            if(_eof) return -1;
+            auto& state = *_cstate;
+            if(state.recv) return 0;
+            auto& iov = state.riov;
+            iov.iov_base = Base::egptr();
+            if(ring_mode()){
+                iov.iov_len = _ring.size() - (Base::egptr() - Base::gptr());
+            } else {
+                size_type buflen = getbuflen(_buffers, Base::eback());
+                if(buflen == SIZE_MAX) return -1;
+                iov.iov_len = Base::eback() + buflen - Base::egptr();
+            }
+            if(iov.iov_len == 0) return 0;
+            auto& msg = state.rmsg;
+            msg = {};
+            msg.msg_name = &state.raddr;
+            msg.msg_namelen = sizeof(state.raddr);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            if(_cbufs[0].size() > 0){
+                state.rcontrol.resize(_cbufs[0].size());
+                msg.msg_control = state.rcontrol.data();
+                msg.msg_controllen = state.rcontrol.size();
+            }
+            state.recv = _engine->recvmsg(_socket, &msg, 0, [cstate = _cstate](int res) -> short {
+                cstate->recv = 0;
+                return cstate->owner ? cstate->owner->_received(res) : 0;
+            });
+            _stats.add(io_stats::RECVMSG);
+            if(state.recv) return 0;
+            _errno = EAGAIN;
+            return -1;
+        }
+        
+        short sockbuf::_sent(int res){
+            if(res < 0){
+                switch(-res){
+                    case EISCONN:
+                        _connected = true;
+                        return _submit_send() ? POLLERR : 0;
+                    case EINTR:
+                        _stats.add(io_stats::INTERRUPTED);
+                        return _submit_send() ? POLLERR : 0;
+                    case EAGAIN:
+                        _stats.add(io_stats::WOULDBLOCK);
+                        return _submit_send() ? POLLERR : 0;
+                    case ECANCELED:
+                        return 0;
+                    default:
+                        _errno = -res;
+                        return POLLERR;
+                }
+            }
+            _stats.add(io_stats::BYTES_OUT, res);
+            _advance(res);
+            if(_wbytes == 0 && Base::pptr() == _pmark){
+                _wqueue.clear();
+                Base::setp(Base::pbase(), Base::epptr());
+                _pmark = Base::pbase();
+                if(_lazy) _trim(std::ios_base::out);
+            } else if(_submit_send()) {
+                return POLLERR;
+            }
+            _want(POLLOUT, _wbytes > 0);
+            return POLLOUT;
+        }
+        
+        short sockbuf::_received(int res){
+            auto& state = *_cstate;
+            if(res < 0){
+                switch(-res){
+                    case EINTR:
+                        _stats.add(io_stats::INTERRUPTED);
+                        return _submit_recv() ? POLLERR : 0;
+                    case EAGAIN:
+                        _stats.add(io_stats::WOULDBLOCK);
+                        return _submit_recv() ? POLLERR : 0;
+                    case ECANCELED:
+                        return 0;
+                    default:
+                        _errno = -res;
+                        _eof = true;
+                        return POLLERR;
+                }
+            }
+            _want(POLLIN, false);
+            if(res == 0){
+                _eof = true;
+                return POLLIN;
+            }
+            _stats.add(io_stats::BYTES_IN, res);
+            Base::setg(Base::eback(), Base::gptr(), static_cast<char_type*>(state.riov.iov_base) + res);
+            auto& address = _addresses[0];
+            std::memcpy(&std::get<sockaddr_storage>(address), &state.raddr, state.rmsg.msg_namelen);
+            std::get<socklen_t>(address) = state.rmsg.msg_namelen;
+            if(state.rmsg.msg_controllen > 0){
+                std::memcpy(_cbufs[0].data(), state.rcontrol.data(), state.rmsg.msg_controllen);
+                _msghdrs[0].msg_control = _cbufs[0].data();
+                _msghdrs[0].msg_controllen = state.rmsg.msg_controllen;
+            }
+            return POLLIN;
+        }
+        
+        // A request still outstanding may write or read the buffers, so they
+        // move to the state its completion holds and are freed with it.
+        void sockbuf::_abandon(){
+            if(!_cstate) return;
+            auto& state = *_cstate;
+            state.owner = nullptr;
+            if(state.send || state.recv){
+                state.buffers = std::move(_buffers);
+                state.retired = std::move(_retired);
+                state.ring = std::move(_ring);
+                if(_engine && state.send) _engine->cancel(state.send);
+                if(_engine && state.recv) _engine->cancel(state.recv);
+            }
+            _cstate.reset();
+        }
+        
         void sockbuf::_memmoverbuf(){
+            if(ring_mode()){
+                size_type size = _ring.size();
+                if(static_cast<size_type>(Base::gptr() - Base::eback()) >= size)
+                    Base::setg(Base::eback(), Base::gptr() - size, Base::egptr() - size);
+                return;
+            }
             auto ga = Base::egptr() - Base::gptr();
             auto oldarea = Base::gptr() - Base::eback();
             auto *nxtegptr = Base::eback();
@@ -223,25 +682,146 @@ namespace io{
                 } else {
                     std::memmove(Base::eback(), Base::gptr(), ga);
                 }
+                _stats.add(io_stats::BYTES_MOVED, ga);
                 nxtegptr += ga;
             }
             Base::setg(Base::eback(), Base::eback(), nxtegptr);
         }
         
         void sockbuf::_resizewbuf(){
-            auto it = std::find_if(_buffers.begin(), _buffers.end(), [&](auto& buf){ return buf.data() == Base::pbase(); });
-            if(it == _buffers.end()) throw std::runtime_error("Write buffer could not be found.");
-            std::size_t off = Base::pptr() - Base::pbase();
-            if(off < BUFSIZE-1 && it->size() > BUFSIZE){
-                it->resize(BUFSIZE);
-                it->shrink_to_fit();
-                Base::setp(it->data(), it->data() + it->size());
-                Base::pbump(off);
-            } else if(Base::pptr() == Base::epptr()) {
-                it->resize(2*(it->size()));
-                Base::setp(it->data(), it->data() + it->size());
-                Base::pbump(off);
+            if(_wbytes == 0 || Base::pptr() != Base::epptr()) return;
+            _wqueue.push_back({{nullptr, 0}, true, {-1, 0}});
+            _retired.push_back(_swapwbuf());
+            _stats.add(io_stats::WBUF_GROWN);
+        }
+
+        sockbuf::size_type sockbuf::append(const char_type *buf, size_type size){
+            if(Base::pbase() == nullptr && _reserve(std::ios_base::out)) return 0;
+            _seal();
+            _wqueue.push_back({{const_cast<char_type*>(buf), size}, false, {-1, 0}});
+            _wbytes += size;
+            return _wbytes;
+        }
+
+        int sockbuf::ring_mode(bool enable){
+            if(!(_which & std::ios_base::in) || enable == ring_mode()) return 0;
+            if(_receiving()) return -1;
+            size_type len = Base::egptr() - Base::gptr();
+            auto& rbuf = _buffers.front();
+            if(enable){
+                try{
+                    _ring = ring_buffer(std::max(BUFSIZE, len));
+                } catch(const std::runtime_error& e) {
+                    return -1;
+                }
+                if(len > 0) std::memcpy(_ring.data(), Base::gptr(), len);
+                Base::setg(_ring.data(), _ring.data(), _ring.data() + len);
+                rbuf = buffer(_resource);
+            } else {
+                rbuf.resize(std::max(BUFSIZE, len));
+                std::memcpy(rbuf.data(), Base::gptr(), len);
+                Base::setg(rbuf.data(), rbuf.data(), rbuf.data() + len);
+                _ring = ring_buffer();
+            }
+            return 0;
+        }
+
+        void sockbuf::batchsize(size_type count, size_type msgsize, size_type cmsgsize){
+            for(auto& batch: _batches){
+                batch.msgs.assign(count, {});
+                batch.iovs.assign(count, {});
+                batch.addrs.assign(count, {});
+                batch.data.assign(count*msgsize, 0);
+                batch.control.assign(count*cmsgsize, 0);
+                batch.msgsize = msgsize;
+                batch.cmsgsize = cmsgsize;
+                batch.head = batch.count = 0;
+                for(size_type i = 0; i < count; ++i){
+                    auto& hdr = batch.msgs[i].msg_hdr;
+                    batch.iovs[i] = {batch.data.data() + i*msgsize, msgsize};
+                    hdr.msg_iov = &batch.iovs[i];
+                    hdr.msg_iovlen = 1;
+                }
+            }
+        }
+
+        int sockbuf::recvbatch(){
+            auto& batch = _batches[0];
+            batch.head = batch.count = 0;
+            if(batch.msgs.empty()) return 0;
+            for(size_type i = 0; i < batch.msgs.size(); ++i){
+                auto& hdr = batch.msgs[i].msg_hdr;
+                hdr.msg_name = &batch.addrs[i];
+                hdr.msg_namelen = sizeof(sockaddr_storage);
+                hdr.msg_control = batch.cmsgsize ? batch.control.data() + i*batch.cmsgsize : nullptr;
+                hdr.msg_controllen = batch.cmsgsize;
+                hdr.msg_flags = 0;
+            }
+            int len = recvmmsg(_socket, batch.msgs.data(), batch.msgs.size(), MSG_DONTWAIT, nullptr);
+            _stats.add(io_stats::RECVMSG);
+            while(len < 0){
+                switch(errno){
+                    case EINTR:
+                        _stats.add(io_stats::INTERRUPTED);
+                        len = recvmmsg(_socket, batch.msgs.data(), batch.msgs.size(), MSG_DONTWAIT, nullptr);
+                        _stats.add(io_stats::RECVMSG);
+                        break;
+                    case EWOULDBLOCK:
+                        _stats.add(io_stats::WOULDBLOCK);
+                        return 0;
+                    default:
+                        _errno = errno;
+                        return -1;
+                }
             }
+            for(int i = 0; i < len; ++i) _stats.add(io_stats::BYTES_IN, batch.msgs[i].msg_len);
+            batch.count = len;
+            return len;
+        }
+
+        int sockbuf::pushbatch(const char_type *buf, size_type size, const struct sockaddr *addr, socklen_t addrlen){
+            auto& batch = _batches[1];
+            if(batch.count == batch.msgs.size() || size > batch.msgsize) return -1;
+            size_type i = batch.count++;
+            auto& hdr = batch.msgs[i].msg_hdr;
+            std::memcpy(batch.data.data() + i*batch.msgsize, buf, size);
+            batch.iovs[i].iov_len = size;
+            if(addr != nullptr){
+                std::memcpy(&batch.addrs[i], addr, addrlen);
+                hdr.msg_name = &batch.addrs[i];
+                hdr.msg_namelen = addrlen;
+            } else {
+                hdr.msg_name = nullptr;
+                hdr.msg_namelen = 0;
+            }
+            hdr.msg_control = nullptr;
+            hdr.msg_controllen = 0;
+            return 0;
+        }
+
+        int sockbuf::sendbatch(){
+            auto& batch = _batches[1];
+            while(batch.head < batch.count){
+                int len = sendmmsg(_socket, batch.msgs.data() + batch.head, batch.count - batch.head, MSG_DONTWAIT | MSG_NOSIGNAL);
+                _stats.add(io_stats::SENDMSG);
+                if(len < 0){
+                    switch(errno){
+                        case EINTR:
+                            _stats.add(io_stats::INTERRUPTED);
+                            continue;
+                        case EWOULDBLOCK:
+                            _stats.add(io_stats::WOULDBLOCK);
+                            return batch.count - batch.head;
+                        default:
+                            _errno = errno;
+                            return -1;
+                    }
+                }
+                for(int i = 0; i < len; ++i) _stats.add(io_stats::BYTES_OUT, batch.msgs[batch.head + i].msg_len);
+                batch.head += len;
+            }
+            batch.head = batch.count = 0;
+            return 0;
         }
 
         sockbuf::Base::pos_type sockbuf::seekoff(Base::off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which){
@@ -292,13 +872,22 @@ namespace io{
         }
 
         int sockbuf::sync() {
+            if(_sync()) return -1;
+            if(_nonblocking) _want(POLLOUT, _wbytes > 0);
+            if(_lazy) _trim(_which);
+            return 0;
+        }
+
+        int sockbuf::_sync() {
+            if(_zcthreshold || zerocopy_pending()) _reap();
             if(_which & std::ios_base::out){
-                std::size_t size = Base::pptr()-Base::pbase();
-                if(size > 0 || _cbufs[1].size() > 0)
-                    if(_send(Base::pbase(), size)) return -1;
+                _seal();
+                if(_wbytes > 0 || _cbufs[1].size() > 0)
+                    if(_send()) return -1;
                 _resizewbuf();
             } else if(_which & std::ios_base::in){
-                if(Base::gptr() != Base::eback()) _memmoverbuf();
+                if(Base::eback() == nullptr && _reserve(std::ios_base::in)) return -1;
+                if(Base::gptr() != Base::eback() && !_receiving()) _memmoverbuf();
                 if(_recv()) return -1;
             }
             return 0;
@@ -307,17 +896,22 @@ namespace io{
         std::streamsize sockbuf::showmanyc() {
             auto which_ = _which;
             _which &= ~std::ios_base::out;
-            if(sync()) {
+            if(_sync()) {
                 _which = which_;
                 return -1;
             }
             _which = which_;
+            if(_lazy) _trim(std::ios_base::in);
             return Base::egptr() - Base::gptr();
         }
         
         sockbuf::int_type sockbuf::overflow(sockbuf::int_type ch){
-            if(Base::pbase() == nullptr) return traits_t::eof();
-            if(sync()) {
+            if(Base::pbase() == nullptr){
+                if(_reserve(std::ios_base::out)) return traits_t::eof();
+                if(!traits_t::eq_int_type(ch, traits_t::eof())) return Base::sputc(ch);
+                return ch;
+            }
+            if(_sync()) {
                 auto& addr = _addresses[1];
                 auto *dst = &(std::get<sockaddr_storage>(addr));
                 auto& len = std::get<socklen_t>(addr);      
@@ -329,38 +923,41 @@ namespace io{
                                 case EALREADY:
                                 case EAGAIN:
                                 case EINPROGRESS:
-                                    if(_poll(_socket, POLLOUT)) return traits_t::eof();
+                                    if(_wait(POLLOUT)) return traits_t::eof();
                                     else return overflow(ch);                            
                                 default:
                                     return traits_t::eof();
                             }
-                        } else if(_poll(_socket, POLLOUT)) return traits_t::eof();
+                        } else if(!_nonblocking && _wait(POLLOUT)) return traits_t::eof();
                         else return overflow(ch);                 
                     default:
                         return traits_t::eof();
                 }
             }
             if(Base::pptr() == Base::epptr()){
-                if(_poll(_socket, POLLOUT)) return traits_t::eof();
+                if(_wait(POLLOUT)) return traits_t::eof();
                 else return overflow(ch);
             }
+            if(_nonblocking) _want(POLLOUT, _wbytes > 0);
             if(!traits_t::eq_int_type(ch, traits_t::eof())) return Base::sputc(ch);
             else return ch;
         }
         
         sockbuf::int_type sockbuf::underflow() {
-            if(Base::eback() == nullptr) return traits_t::eof();
+            if(Base::eback() == nullptr && _reserve(std::ios_base::in)) return traits_t::eof();
             auto which_ = _which;
             _which &= ~std::ios_base::out;
-            if(sync()) {
+            if(_sync()) {
                 _which = which_;
                 return traits_t::eof();
             }
             _which = which_;
             if(Base::gptr() == Base::egptr()) {
-                if(_poll(_socket, POLLIN)) return traits_t::eof();
+                if(_lazy) _trim(std::ios_base::in);
+                if(_wait(POLLIN)) return traits_t::eof();
                 return underflow();
             }
+            if(_nonblocking) _want(POLLIN, false);
             return traits_t::to_int_type(*Base::gptr());
         }
 
@@ -380,49 +977,100 @@ namespace io{
             Base(std::move(other)),
             BUFSIZE{std::move(other.BUFSIZE)},
             _which{std::move(other._which)},
+            _resource{other._resource},
             _buffers{std::move(other._buffers)},
+            _ring{std::move(other._ring)},
+            _retired{std::move(other._retired)},
+            _spare{std::move(other._spare)},
+            _wqueue{std::move(other._wqueue)},
+            _zcbufs{std::move(other._zcbufs)},
             _cbufs{std::move(other._cbufs)},
             _msghdrs{std::move(other._msghdrs)},
+            _batches{std::move(other._batches)},
             _addresses{std::move(other._addresses)},
-            _socket{std::move(other._socket)}
+            _socket{std::move(other._socket)},
+            _pmark{other._pmark},
+            _wbytes{other._wbytes},
+            _zcthreshold{other._zcthreshold},
+            _zcnext{other._zcnext},
+            _zcdone{other._zcdone},
+            _lazy{other._lazy},
+            _interest{std::move(other._interest)},
+            _blocked{other._blocked},
+            _nonblocking{other._nonblocking},
+            _stats{std::move(other._stats)},
+            _engine{other._engine},
+            _cstate{std::move(other._cstate)},
+            _eof{other._eof}
         {
+            if(_cstate) _cstate->owner = this;
+            other._engine = nullptr;
             other._socket = 0;
+            other._pmark = nullptr;
+            other._wbytes = 0;
         }
 
         sockbuf& sockbuf::operator=(sockbuf&& other){
+            _abandon();
+            _engine = other._engine;
+            _cstate = std::move(other._cstate);
+            _eof = other._eof;
+            if(_cstate) _cstate->owner = this;
+            other._engine = nullptr;
             BUFSIZE = std::move(other.BUFSIZE);
             _which = std::move(other._which);
+            _resource = other._resource;
             _buffers = std::move(other._buffers);
+            _ring = std::move(other._ring);
+            _retired = std::move(other._retired);
+            _spare = std::move(other._spare);
+            _wqueue = std::move(other._wqueue);
+            _zcbufs = std::move(other._zcbufs);
+            _pmark = other._pmark;
+            _wbytes = other._wbytes;
+            _zcthreshold = other._zcthreshold;
+            _zcnext = other._zcnext;
+            _zcdone = other._zcdone;
+            _lazy = other._lazy;
+            _interest = std::move(other._interest);
+            _blocked = other._blocked;
+            _nonblocking = other._nonblocking;
+            _stats = std::move(other._stats);
             _cbufs = std::move(other._cbufs);
             _msghdrs = std::move(other._msghdrs);
+            _batches = std::move(other._batches);
             _addresses = std::move(other._addresses);
             _socket = std::move(other._socket);
             auto& wbuf = _buffers[1];
             setp(wbuf.data(), wbuf.data()+wbuf.size());
             pbump(other.pptr() - other.pbase());
-            auto& rbuf = _buffers[0];
+            auto *rbuf = ring_mode() ? _ring.data() : _buffers[0].data();
             auto goff = other.gptr() - other.eback();
             auto egoff = other.egptr() - other.eback();
-            setg(rbuf.data(), rbuf.data() + goff, rbuf.data() + egoff);
+            setg(rbuf, rbuf + goff, rbuf + egoff);
             other.setp(nullptr, nullptr);
             other.setg(nullptr, nullptr, nullptr);
             other._socket = 0;
+            other._pmark = nullptr;
+            other._wbytes = 0;
             return *this;
         }
 
-        sockbuf::sockbuf(native_handle_type sockfd, std::ios_base::openmode which):
+        sockbuf::sockbuf(native_handle_type sockfd, std::ios_base::openmode which, bool lazy):
             Base(),
             BUFSIZE{DEFAULT_BUFSIZE},
             _which{which},
-            _socket{sockfd}
+            _socket{sockfd},
+            _lazy{lazy}
         {
             _init_buf_ptrs();
         }
         
-        sockbuf::sockbuf(int domain, int type, int protocol, std::initializer_list<sockopt> l, std::ios_base::openmode which):
+        sockbuf::sockbuf(int domain, int type, int protocol, std::initializer_list<sockopt> l, std::ios_base::openmode which, bool lazy):
             Base(),
             BUFSIZE{DEFAULT_BUFSIZE},
-            _which{which}
+            _which{which},
+            _lazy{lazy}
         {
             if((_socket = socket(domain, type, protocol)) < 0) throw std::runtime_error("Can't open socket.");
             for(auto& opt : l){
@@ -459,6 +1107,12 @@ namespace io{
                 switch(errno){
                     case EINTR:
                         return connectto(addr, addrlen);
+                    case EINPROGRESS:
+                    case EALREADY:
+                        _errno = errno;
+                        if(_nonblocking) _want(POLLOUT, true);
+                        ret = -1;
+                        break;
                     default:
                         _errno = errno;
                         ret = -1;
@@ -475,6 +1129,7 @@ namespace io{
         }
 
         sockbuf::~sockbuf(){
+            _abandon();
             if(_socket > 2) close(_socket);
         }
     }
@@ -0,0 +1,95 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "buffers.hpp"
+#include <chrono>
+#include <mutex>
+namespace io{
+    namespace buffers{
+#if defined(IO_STATS)
+        static std::mutex _registry_mtx;
+        static stream_stats *_registry = nullptr;
+        // The counters of streams that have been destroyed.
+        static io_stats _retired{};
+        
+        stream_stats::stream_stats(){
+            std::lock_guard<std::mutex> lock(_registry_mtx);
+            if((_next = _registry)) _next->_prev = this;
+            _registry = this;
+        }
+        
+        stream_stats::stream_stats(stream_stats&& other):
+            stream_stats()
+        {
+            std::lock_guard<std::mutex> lock(_registry_mtx);
+            _take(other);
+        }
+        
+        stream_stats& stream_stats::operator=(stream_stats&& other){
+            if(this == &other) return *this;
+            std::lock_guard<std::mutex> lock(_registry_mtx);
+            _retired += snapshot();
+            _take(other);
+            return *this;
+        }
+        
+        // Counters move under the registry lock so aggregate_stats() never
+        // sees them twice or not at all.
+        void stream_stats::_take(stream_stats& other){
+            for(std::size_t i = 0; i < io_stats::NCOUNTERS; ++i){
+                _counters[i].store(other._counters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                other._counters[i].store(0, std::memory_order_relaxed);
+            }
+        }
+        
+        std::uint64_t stream_stats::now(){
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()
+            ).count();
+        }
+        
+        io_stats stream_stats::snapshot() const {
+            io_stats stats;
+            for(std::size_t i = 0; i < io_stats::NCOUNTERS; ++i)
+                stats.counters[i] = _counters[i].load(std::memory_order_relaxed);
+            return stats;
+        }
+        
+        stream_stats::~stream_stats(){
+            std::lock_guard<std::mutex> lock(_registry_mtx);
+            _retired += snapshot();
+            if(_prev) _prev->_next = _next;
+            else _registry = _next;
+            if(_next) _next->_prev = _prev;
+        }
+        
+        io_stats aggregate_stats(){
+            std::lock_guard<std::mutex> lock(_registry_mtx);
+            io_stats total{};
+            for(auto *stats = _registry; stats != nullptr; stats = stats->_next)
+                total += stats->snapshot();
+            return total;
+        }
+        
+        io_stats retired_stats(){
+            std::lock_guard<std::mutex> lock(_registry_mtx);
+            return _retired;
+        }
+#else
+        io_stats aggregate_stats() { return {}; }
+        io_stats retired_stats() { return {}; }
+#endif
+    }
+}
@@ -17,6 +17,7 @@
 #include <iostream>
 #include <ios>
 #include <initializer_list>
+#include <poll.h>
 
 #pragma once
 #ifndef IO_STREAMS
@@ -26,6 +27,25 @@ namespace io{
         using optname = std::string;
         using optval = std::vector<char>;
         using sockopt = std::tuple<std::string, std::vector<char> >;
+        namespace sockopts = buffers::sockopts;
+        
+        // Adds the events a non-blocking stream is waiting for to a
+        // trigger's interest in its handle, and clears them again once the
+        // stream stops waiting. Only events it added itself are cleared, so
+        // interest the caller set on the handle is left alone.
+        template<class TriggerT>
+        auto watch(TriggerT& trigger){
+            return [&trigger, added = short{0}](int handle, short events) mutable {
+                if(short idle = added & ~events){
+                    trigger.clear(handle, idle);
+                    added &= ~idle;
+                }
+                if(short wanted = events & ~trigger.interest(handle)){
+                    trigger.set(handle, wanted);
+                    added |= wanted;
+                }
+            };
+        }
         
         class pipestream: public std::iostream {
             using Base = std::iostream;
@@ -49,6 +69,14 @@ namespace io{
                 void close_read() { return _buf.close_read(); }
                 void close_write() { return _buf.close_write(); }
                 std::size_t write_remaining() { return _buf.write_remaining(); }
+                int ring_mode(bool enable) { return _buf.ring_mode(enable); }
+                void nonblocking(bool enable, buffers::pipebuf::interest_type interest = {}) { _buf.nonblocking(enable, std::move(interest)); }
+                template<class TriggerT>
+                void nonblocking(TriggerT& trigger) { _buf.nonblocking(true, watch(trigger)); }
+                short blocked() { return _buf.blocked(); }
+                int fill() { return _buf.fill(); }
+                int drain() { return _buf.drain(); }
+                buffers::io_stats stats() const { return _buf.stats(); }
                 
                 ~pipestream(){}
         };
@@ -81,14 +109,14 @@ namespace io{
                     _buf(sockfd)
                 {}
                     
-                explicit sockstream(native_handle_type sockfd, std::ios_base::openmode which):
+                explicit sockstream(native_handle_type sockfd, std::ios_base::openmode which, bool lazy = false):
                     Base(&_buf),
-                    _buf(sockfd, which)
+                    _buf(sockfd, which, lazy)
                 {}
             
-                explicit sockstream(int domain, int type, int protocol, std::initializer_list<sockopt> l, std::ios_base::openmode which):
+                explicit sockstream(int domain, int type, int protocol, std::initializer_list<sockopt> l, std::ios_base::openmode which, bool lazy = false):
                     Base(&_buf),
-                    _buf(domain, type, protocol, l, which)
+                    _buf(domain, type, protocol, l, which, lazy)
                 {}
 
                 sockstream& operator=(sockstream&& other);
@@ -96,11 +124,36 @@ namespace io{
 
                 void setopt(sockopt opt){ _buf.pubsetopt(opt); }
                 optval getopt(sockopt opt){ return _buf.pubgetopt(opt); }
+                template<int Level, int Name, class T>
+                int setopt(const buffers::socket_option<Level, Name, T>& opt){ return _buf.pubsetopt(opt); }
+                template<int Level, int Name, class T>
+                int getopt(buffers::socket_option<Level, Name, T>& opt){ return _buf.pubgetopt(opt); }
                 sockbuf::cbuf_array_t& cmsgs() { return _buf.cmsgs(); }
                 sockbuf::msghdr_array_t& msghdrs() { return _buf.msghdrs(); }
                 sockbuf::native_handle_type native_handle() { return _buf.native_handle(); }
                 sockbuf::storage_array& addresses() { return _buf.addresses(); }
+                sockbuf::batch_array_t& batches() { return _buf.batches(); }
+                void batchsize(std::size_t count, std::size_t msgsize, std::size_t cmsgsize = 0) { _buf.batchsize(count, msgsize, cmsgsize); }
+                int recvbatch() { return _buf.recvbatch(); }
+                int pushbatch(const char *buf, std::size_t size, const struct sockaddr *addr = nullptr, socklen_t addrlen = 0) { return _buf.pushbatch(buf, size, addr, addrlen); }
+                int sendbatch() { return _buf.sendbatch(); }
                 int err() { return _buf.err(); }
+                int ring_mode(bool enable) { return _buf.ring_mode(enable); }
+                std::size_t append(const char *buf, std::size_t size) { return _buf.append(buf, size); }
+                std::size_t pending() { return _buf.pending(); }
+                std::size_t appendfile(native_handle_type fd, off_t offset, std::size_t count) { return _buf.appendfile(fd, offset, count); }
+                int zerocopy(std::size_t threshold) { return _buf.zerocopy(threshold); }
+                std::size_t zerocopy_pending() { return _buf.zerocopy_pending(); }
+                void lazy(bool enable) { _buf.lazy(enable); }
+                void nonblocking(bool enable, sockbuf::interest_type interest = {}) { _buf.nonblocking(enable, std::move(interest)); }
+                template<class TriggerT>
+                void nonblocking(TriggerT& trigger) { _buf.nonblocking(true, watch(trigger)); }
+                short blocked() { return _buf.blocked(); }
+                std::size_t buffered() { return _buf.buffered(); }
+                int fill() { return _buf.fill(); }
+                int drain() { return _buf.drain(); }
+                int completion(buffers::completion_engine *engine) { return _buf.completion(engine); }
+                buffers::io_stats stats() const { return _buf.stats(); }
                 int connectto(const struct sockaddr* addr, socklen_t len) { return _buf.connectto(addr, len); }
                 
                 ~sockstream(){}
@@ -0,0 +1,78 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "io.hpp"
+#if defined(__linux__)
+#include <stdexcept>
+#include <cerrno>
+#include <cstdint>
+#include <sys/eventfd.h>
+#include <unistd.h>
+namespace io{
+	task_queue::task_queue(){
+		if((_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) throw std::runtime_error("Unable to create eventfd.");
+	}
+	
+	int task_queue::post(task_type task){
+		auto *node = new node_type{std::move(task), _head.load(std::memory_order_relaxed)};
+		while(!_head.compare_exchange_weak(node->next, node));
+		if(_signalled.exchange(true)) return 0;
+		std::uint64_t one = 1;
+		while(write(_fd, &one, sizeof(one)) < 0){
+			if(errno != EINTR) return -1;
+		}
+		return 0;
+	}
+	
+	// Only the post that sets the flag writes the eventfd, and the flag is
+	// cleared once that write has been read back, before the stack is
+	// taken. A post that lands after the take then always sees the flag
+	// clear and wakes the loop again, and one that has set the flag but
+	// not yet written leaves it set for the run its write will wake.
+	task_queue::size_type task_queue::run(){
+		if(!_signalled.load()) return 0;
+		std::uint64_t count = 0;
+		ssize_t len = 0;
+		while((len = read(_fd, &count, sizeof(count))) < 0 && errno == EINTR);
+		if(len > 0) _signalled.store(false);
+		node_type *head = _head.exchange(nullptr), *fifo = nullptr;
+		while(head != nullptr){
+			node_type *next = head->next;
+			head->next = fifo;
+			fifo = head;
+			head = next;
+		}
+		size_type ran = 0;
+		while(fifo != nullptr){
+			node_type *next = fifo->next;
+			if(fifo->task) fifo->task();
+			delete fifo;
+			fifo = next;
+			++ran;
+		}
+		return ran;
+	}
+	
+	task_queue::~task_queue(){
+		node_type *head = _head.exchange(nullptr);
+		while(head != nullptr){
+			node_type *next = head->next;
+			delete head;
+			head = next;
+		}
+		if(_fd > 2) close(_fd);
+	}
+}
+#endif
@@ -0,0 +1,366 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+#include "io.hpp"
+#if defined(__linux__)
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+namespace io{
+	// Completions that are not reported, such as those of timeouts and
+	// cancellations, carry TIMEOUT_DATA. Poll completions carry the handle
+	// and completion requests their slot, each with 31 bits of generation,
+	// and REQUEST_DATA tells the two apart.
+	static constexpr std::uint64_t TIMEOUT_DATA = UINT64_MAX;
+	static constexpr std::uint64_t REQUEST_DATA = std::uint64_t(1) << 63;
+	static constexpr std::uint32_t GEN_MASK = 0x7fffffff;
+	
+	static std::uint64_t _userdata(int handle, std::uint32_t gen){
+		return (static_cast<std::uint64_t>(gen & GEN_MASK) << 32) | static_cast<std::uint32_t>(handle);
+	}
+	
+	upoller::upoller(bool multishot, unsigned entries): 
+		Base(),
+		_multishot{multishot}
+	{
+		struct io_uring_params params = {};
+		if((_ringfd = syscall(__NR_io_uring_setup, entries, &params)) < 0) throw std::runtime_error("Unable to create io_uring instance.");
+		_ext_arg = params.features & IORING_FEAT_EXT_ARG;
+		_sq_entries = params.sq_entries;
+		_sq_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+		_cq_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+		if(params.features & IORING_FEAT_SINGLE_MMAP){
+			if(_cq_size > _sq_size) _sq_size = _cq_size;
+			_cq_size = 0;
+		}
+		_sq_ptr = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQ_RING);
+		if(_sq_ptr == MAP_FAILED){
+			close(_ringfd);
+			throw std::runtime_error("Unable to map io_uring submission ring.");
+		}
+		if(_cq_size){
+			_cq_ptr = mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_CQ_RING);
+			if(_cq_ptr == MAP_FAILED){
+				munmap(_sq_ptr, _sq_size);
+				close(_ringfd);
+				throw std::runtime_error("Unable to map io_uring completion ring.");
+			}
+		} else _cq_ptr = _sq_ptr;
+		_sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+		void *sqes = mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQES);
+		if(sqes == MAP_FAILED){
+			if(_cq_size) munmap(_cq_ptr, _cq_size);
+			munmap(_sq_ptr, _sq_size);
+			close(_ringfd);
+			throw std::runtime_error("Unable to map io_uring submission entries.");
+		}
+		_sqes = static_cast<struct io_uring_sqe*>(sqes);
+		
+		auto *sq = static_cast<char*>(_sq_ptr);
+		_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+		_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		_sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		auto *array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		for(unsigned i = 0; i < params.sq_entries; ++i) array[i] = i;
+		
+		auto *cq = static_cast<char*>(_cq_ptr);
+		_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		_cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+	}
+	
+	int upoller::_submit(unsigned min_complete, unsigned flags, void *arg, std::size_t argsz){
+		int ret = syscall(__NR_io_uring_enter, _ringfd, _pending, min_complete, flags, arg, argsz);
+		if(ret < 0) return -1;
+		_pending -= ret;
+		return 0;
+	}
+	
+	struct io_uring_sqe *upoller::_getsqe(){
+		unsigned tail = *_sq_tail;
+		if(tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == _sq_entries){
+			if(_submit(0, 0, nullptr, 0)) return nullptr;
+			if(tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) == _sq_entries) return nullptr;
+		}
+		auto *sqe = &_sqes[tail & *_sq_mask];
+		std::memset(sqe, 0, sizeof(*sqe));
+		__atomic_store_n(_sq_tail, tail+1, __ATOMIC_RELEASE);
+		++_pending;
+		return sqe;
+	}
+	
+	void upoller::_arm(native_handle_type handle){
+		auto& interest = _interest[handle];
+		auto *sqe = _getsqe();
+		if(sqe == nullptr) return;
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = handle;
+		sqe->poll32_events = static_cast<std::uint16_t>(std::get<event_mask>(interest));
+		if(_multishot) sqe->len = IORING_POLL_ADD_MULTI;
+		sqe->user_data = _userdata(handle, std::get<std::uint32_t>(interest));
+	}
+	
+	void upoller::_disarm(native_handle_type handle){
+		auto& interest = _interest[handle];
+		auto *sqe = _getsqe();
+		if(sqe != nullptr){
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = _userdata(handle, std::get<std::uint32_t>(interest));
+			sqe->user_data = TIMEOUT_DATA;
+		}
+		++std::get<std::uint32_t>(interest);
+	}
+	
+	upoller::size_type upoller::_add(native_handle_type handle, events_type& events, event_type event){
+		if(handle < 0) return npos;
+		if(static_cast<size_type>(handle) >= _interest.size()) _interest.resize(handle+1);
+		auto& mask = std::get<event_mask>(_interest[handle]);
+		if(mask) return npos;
+		mask = event.events;
+		_arm(handle);
+		events.push_back({});
+		return events.size();
+	}
+	
+	upoller::size_type upoller::_update(native_handle_type handle, events_type& events, event_type event){
+		if(handle < 0 || static_cast<size_type>(handle) >= _interest.size()) return npos;
+		auto& mask = std::get<event_mask>(_interest[handle]);
+		if(!mask) return npos;
+		_disarm(handle);
+		mask = event.events;
+		_arm(handle);
+		return events.size();
+	}
+	
+	upoller::size_type upoller::_del(native_handle_type handle, events_type& events){
+		if(handle < 0 || static_cast<size_type>(handle) >= _interest.size()) return npos;
+		auto& mask = std::get<event_mask>(_interest[handle]);
+		if(!mask) return npos;
+		_disarm(handle);
+		mask = 0;
+		events.pop_back();
+		if(_stale > events.size()) _stale = events.size();
+		return events.size();
+	}
+	
+	upoller::id_type upoller::_request(std::uint8_t opcode, native_handle_type handle, struct msghdr *msg, int flags, done_type done){
+		auto *sqe = _getsqe();
+		if(sqe == nullptr) return 0;
+		std::uint32_t slot = 0;
+		if(_free.empty()){
+			slot = _requests.size();
+			_requests.emplace_back();
+		} else {
+			slot = _free.back();
+			_free.pop_back();
+		}
+		auto& request = _requests[slot];
+		request.done = std::move(done);
+		request.handle = handle;
+		sqe->opcode = opcode;
+		sqe->fd = handle;
+		sqe->addr = reinterpret_cast<std::uint64_t>(msg);
+		sqe->len = 1;
+		sqe->msg_flags = flags;
+		sqe->user_data = REQUEST_DATA | _userdata(slot, request.gen);
+		++_outstanding;
+		return sqe->user_data;
+	}
+	
+	upoller::id_type upoller::sendmsg(int handle, const struct msghdr *msg, int flags, done_type done){
+		return _request(IORING_OP_SENDMSG, handle, const_cast<struct msghdr*>(msg), flags, std::move(done));
+	}
+	
+	upoller::id_type upoller::recvmsg(int handle, struct msghdr *msg, int flags, done_type done){
+		return _request(IORING_OP_RECVMSG, handle, msg, flags, std::move(done));
+	}
+	
+	void upoller::cancel(id_type id){
+		auto slot = static_cast<std::uint32_t>(id);
+		if(!(id & REQUEST_DATA) || slot >= _requests.size()) return;
+		auto& request = _requests[slot];
+		if(!request.done || ((id >> 32) & GEN_MASK) != (request.gen & GEN_MASK)) return;
+		auto *sqe = _getsqe();
+		if(sqe == nullptr) return;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = id;
+		sqe->user_data = TIMEOUT_DATA;
+	}
+	
+	// Moves the completion ring into _reaped and _completed, re-arming
+	// single-shot polls on the way.
+	void upoller::_reap(){
+		unsigned head = *_cq_head;
+		unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+		for(; head != tail; ++head){
+			auto& cqe = _cqes[head & *_cq_mask];
+			if(cqe.user_data == TIMEOUT_DATA) continue;
+			std::uint32_t gen = (cqe.user_data >> 32) & GEN_MASK;
+			auto index = static_cast<std::uint32_t>(cqe.user_data);
+			if(cqe.user_data & REQUEST_DATA){
+				if(index < _requests.size() && _requests[index].done && gen == (_requests[index].gen & GEN_MASK))
+					_completed.push_back({index, cqe.res});
+				continue;
+			}
+			native_handle_type handle = index;
+			auto& interest = _interest[handle];
+			if(gen != (std::get<std::uint32_t>(interest) & GEN_MASK)) continue;
+			if(cqe.res < 0) continue;
+			if(!(cqe.flags & IORING_CQE_F_MORE)) _arm(handle);
+			_reaped.push_back({handle, std::get<event_mask>(interest), static_cast<short>(cqe.res)});
+		}
+		__atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+	}
+	
+	upoller::size_type upoller::_poll(duration_type timeout){ return upoller::_pwait(timeout, nullptr); }
+	
+	// Submits whatever is queued and, unless the timeout is zero or
+	// completions are already waiting, blocks for one. Returns 1 when the
+	// wait timed out or was interrupted, leaving ETIME or EINTR in errno.
+	int upoller::_enter(duration_type timeout, const signal_type *sigmask){
+		struct __kernel_timespec ts = {};
+		struct io_uring_getevents_arg arg = {};
+		unsigned min_complete = 0, flags = 0;
+		void *argp = nullptr;
+		std::size_t argsz = 0;
+		if(timeout.count() != 0 && *_cq_head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)){
+			min_complete = 1;
+			flags |= IORING_ENTER_GETEVENTS;
+			if(timeout.count() > 0){
+				ts.tv_sec = timeout.count() / 1000;
+				ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+				if(_ext_arg){
+					arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+					flags |= IORING_ENTER_EXT_ARG;
+					argp = &arg;
+					argsz = sizeof(arg);
+				} else if(auto *sqe = _getsqe()) {
+					sqe->opcode = IORING_OP_TIMEOUT;
+					sqe->fd = -1;
+					sqe->addr = reinterpret_cast<std::uint64_t>(&ts);
+					sqe->len = 1;
+					sqe->user_data = TIMEOUT_DATA;
+				}
+			}
+			if(sigmask && _ext_arg){
+				arg.sigmask = reinterpret_cast<std::uint64_t>(sigmask);
+				arg.sigmask_sz = _NSIG / 8;
+				flags |= IORING_ENTER_EXT_ARG;
+				argp = &arg;
+				argsz = sizeof(arg);
+			} else if(sigmask) {
+				argp = const_cast<signal_type*>(sigmask);
+				argsz = _NSIG / 8;
+			}
+		}
+		int status = 0;
+		if((_pending || flags) && _submit(min_complete, flags, argp, argsz)){
+			if(errno != ETIME && errno != EINTR) return -1;
+			status = 1;
+		}
+		_reap();
+		return status;
+	}
+	
+	// The signal mask, like the timeout, only matters when io_uring_enter
+	// actually waits for a completion. Completions the caller never sees,
+	// such as a removed poll or an expired timeout, do not end the wait
+	// early; it goes back to sleep for whatever is left of the timeout.
+	upoller::size_type upoller::_pwait(duration_type timeout, const signal_type *sigmask){
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		_reaped.clear();
+		Base::_completionlist().clear();
+		for(;;){
+			int status = _enter(timeout, sigmask);
+			if(status < 0) return npos;
+			if(status > 0 || timeout.count() == 0 || !_reaped.empty() || !_completed.empty()) break;
+			if(timeout.count() > 0){
+				timeout = std::chrono::ceil<duration_type>(deadline - std::chrono::steady_clock::now());
+				if(timeout.count() <= 0) break;
+			}
+		}
+		// Completions may change interest, so they run before the events
+		// are written, and readiness reported for a handle they removed is
+		// dropped. Their own events go to the completion list, so the event
+		// list keeps one slot per registration, as _del expects.
+		events_type& completions = Base::_completionlist();
+		for(auto& [slot, res]: _completed){
+			auto& request = _requests[slot];
+			done_type done = std::move(request.done);
+			native_handle_type handle = request.handle;
+			request.done = nullptr;
+			++request.gen;
+			_free.push_back(slot);
+			--_outstanding;
+			if(short revents = done(res)) completions.push_back({handle, 0, revents});
+		}
+		if(!_completed.empty()){
+			_completed.clear();
+			auto end = std::remove_if(_reaped.begin(), _reaped.end(), [&](const event_type& event){
+				return !std::get<event_mask>(_interest[event.fd]);
+			});
+			_reaped.erase(end, _reaped.end());
+		}
+		
+		// A multishot poll can complete more than once between waits, and
+		// those are merged when they would not fit.
+		events_type& events = Base::_eventlist();
+		size_type nfds = _reaped.size();
+		if(nfds > events.size()){
+			std::sort(_reaped.begin(), _reaped.end(), [](const event_type& a, const event_type& b){ return a.fd < b.fd; });
+			nfds = 0;
+			for(auto& event: _reaped){
+				if(nfds && _reaped[nfds-1].fd == event.fd) _reaped[nfds-1].revents |= event.revents;
+				else _reaped[nfds++] = event;
+			}
+			nfds = std::min(nfds, events.size());
+		}
+		std::copy(_reaped.begin(), _reaped.begin() + nfds, events.begin());
+		for(size_type i = nfds; i < _stale; ++i) events[i] = {};
+		_stale = nfds;
+		return nfds + completions.size();
+	}
+	
+	upoller::~upoller(){
+		for(std::uint32_t slot = 0; slot < _requests.size(); ++slot)
+			if(_requests[slot].done) cancel(REQUEST_DATA | _userdata(slot, _requests[slot].gen));
+		while(_outstanding > 0){
+			if(_submit(1, IORING_ENTER_GETEVENTS, nullptr, 0) && errno != EINTR) break;
+			_reap();
+			for(auto& [slot, res]: _completed){
+				_requests[slot].done = nullptr;
+				--_outstanding;
+			}
+			_completed.clear();
+		}
+		munmap(_sqes, _sqes_size);
+		if(_cq_size) munmap(_cq_ptr, _cq_size);
+		munmap(_sq_ptr, _sq_size);
+		if(_ringfd > 2) close(_ringfd);
+	}
+	
+	utrigger::event_type utrigger::mkevent(native_handle_type handle, trigger_type trigger){
+		return make_event<event_type>(handle, trigger);
+	}
+}
+#endif
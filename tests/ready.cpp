@@ -0,0 +1,74 @@
+/*     
+*	Copyright 2025 Kevin Exton
+*	This file is part of cpp-aio.
+*
+* cpp-aio is free software: you can redistribute it and/or modify it under the 
+*	terms of the GNU General Public License as published by the Free Software 
+*	Foundation, either version 3 of the License, or any later version.
+*
+* cpp-aio is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; 
+*	without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. 
+*	See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with cpp-aio. 
+*	If not, see <https://www.gnu.org/licenses/>. 
+*/
+// Registers and clears handles while iterating a trigger's ready() view,
+// the way an acceptor or a reactor shard does from its handler. make test
+// builds it with AddressSanitizer, so a view into reallocated memory is
+// caught.
+#include "io.hpp"
+#include <cassert>
+#include <cstdio>
+#include <set>
+#include <vector>
+#include <unistd.h>
+
+template<class TriggerT>
+static void mutate_while_iterating(const char *name){
+	constexpr int READY = 32, EXTRA = 256;
+	TriggerT trigger;
+	std::vector<int> readers, writers, extra;
+	for(int i = 0; i < READY; ++i){
+		int p[2];
+		assert(pipe(p) == 0);
+		readers.push_back(p[0]);
+		writers.push_back(p[1]);
+		trigger.set(p[0], POLLIN);
+		assert(write(p[1], "x", 1) == 1);
+	}
+	for(int i = 0; i < EXTRA; ++i){
+		int p[2];
+		assert(pipe(p) == 0);
+		extra.push_back(p[0]);
+		extra.push_back(p[1]);
+	}
+	assert(trigger.wait(std::chrono::milliseconds(100)) == READY);
+	std::set<int> seen;
+	std::size_t next = 0;
+	for(auto& event: trigger.ready()){
+		int fd = io::native_handle(event);
+		assert(seen.insert(fd).second);
+		// Grow the poller's event array past its capacity, and remove
+		// handles that are still waiting to be visited.
+		for(int i = 0; i < 8 && next < extra.size(); ++i) trigger.set(extra[next++], POLLIN);
+		trigger.clear(readers[(fd * 7) % READY]);
+		trigger.clear(fd);
+	}
+	assert(static_cast<int>(seen.size()) == READY);
+	for(int fd: readers) assert(seen.count(fd) == 1);
+	for(int fd: readers) close(fd);
+	for(int fd: writers) close(fd);
+	for(int fd: extra) close(fd);
+	std::printf("%s: ok\n", name);
+}
+
+int main(){
+	mutate_while_iterating<io::trigger>("poll");
+	mutate_while_iterating<io::static_trigger>("static poll");
+#if defined(__linux__)
+	mutate_while_iterating<io::etrigger>("epoll");
+	mutate_while_iterating<io::static_etrigger>("static epoll");
+#endif
+	return 0;
+}